@@ -0,0 +1,263 @@
+// Conformance test of the two-stage json parser of transport-catalogue.
+// json::LoadIndexed must accept the same documents as json::Load and give
+// the same result, also on one and on several threads, and reject the
+// same broken ones. Every SIMD backend of the structural index must give
+// the index of the scalar one. Documents are random valid ones, the files
+// given, and the broken ones made of them: truncated, with bad escapes,
+// stray quotes and characters dropped.
+//
+//     cd json-conformance-test && g++ -std=c++17 -O2 -pthread -I../transport-catalogue json_conformance_test.cpp
+//         ../transport-catalogue/json.cpp ../transport-catalogue/json_index.cpp -o json_conformance_test
+//     json_conformance_test [--count <documents>] [--seed <seed>] [<file>...]
+
+#include "json.h"
+#include "json_index.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std::literals;
+
+namespace json_conformance_test {
+
+    class Checker {
+    public:
+        explicit Checker(unsigned seed)
+            : random_(seed) {
+        }
+
+        // The document and the broken ones made of it
+        void CheckAll(const std::string& text) {
+            Check(text, "valid"sv);
+            CheckIndexReference(text);
+
+            // Every prefix of short documents, some of long ones
+            const size_t step = std::max<size_t>(1, text.size() / 64);
+            for (size_t size = 0; size < text.size(); size += step) {
+                Check(text.substr(0, size), "truncated"sv);
+            }
+            if (text.empty()) {
+                return;
+            }
+            for (const std::string_view insert : {"\\q"sv, "\\u"sv, "\\"sv, "\\\\\\"sv, "\""sv, "\"\""sv}) {
+                std::string broken = text;
+                broken.insert(Position(text), insert);
+                Check(broken, insert.find('\\') == insert.npos ? "stray quote"sv : "bad escape"sv);
+            }
+            std::string broken = text;
+            broken.erase(Position(text) % text.size(), 1);
+            Check(broken, "dropped character"sv);
+        }
+
+        // Large arrays at the root, which LoadIndexed splits between threads
+        std::string MakeLargeDocument() {
+            const size_t count = 600 + random_() % 2000;
+            const bool in_dict = random_() % 2;
+            std::string text = in_dict ? "{\"a\": 1, \"base_requests\": ["s : "["s;
+            for (size_t i = 0; i < count; ++i) {
+                if (i > 0) {
+                    text += random_() % 4 ? ","sv : " , "sv;
+                }
+                text += MakeValue(1);
+            }
+            text += in_dict ? "], \"z\": [1]}"sv : "]"sv;
+            return text;
+        }
+
+        std::string MakeValue(int depth) {
+            static const std::string_view numbers[] = {"0"sv, "-0"sv, "12"sv, "-7"sv, "3.25"sv, "1e5"sv, "2E-3"sv,
+                                                       "-0.5e+2"sv, "2147483647"sv, "2147483648"sv, "-2147483649"sv,
+                                                       "99999999999999999999"sv, "0.1"sv};
+            switch (random_() % (depth > 4 ? 5 : 8)) {
+                case 0:
+                    return "\"" + MakeString() + "\"";
+                case 1:
+                    return std::string(numbers[random_() % std::size(numbers)]);
+                case 2:
+                    return random_() % 2 ? "true" : "false";
+                case 3:
+                    return "null";
+                case 4:
+                    return "\"\"";
+                case 5:
+                case 6: {
+                    std::string text = "[";
+                    for (size_t i = 0, count = random_() % 5; i < count; ++i) {
+                        if (i > 0) {
+                            text += random_() % 3 ? ","sv : " , "sv;
+                        }
+                        text += MakeValue(depth + 1);
+                    }
+                    return text + (random_() % 2 ? "]" : " ]");
+                }
+                default: {
+                    // Few key names, so duplicates come up too
+                    std::string text = "{";
+                    for (size_t i = 0, count = random_() % 5; i < count; ++i) {
+                        if (i > 0) {
+                            text += ',';
+                        }
+                        text += "\"k" + std::to_string(random_() % 6) + MakeString() + "\"";
+                        text += random_() % 2 ? ":"sv : " : "sv;
+                        text += MakeValue(depth + 1);
+                    }
+                    return text + "}";
+                }
+            }
+        }
+
+        size_t GetFailures() const {
+            return failures_;
+        }
+
+        size_t GetChecks() const {
+            return checks_;
+        }
+
+    private:
+        // Structural characters and escaped quotes inside strings, and
+        // multibyte characters crossing the blocks of the index
+        std::string MakeString() {
+            static const std::string_view parts[] = {"a"sv, "\\\\"sv, "\\\""sv, "\\n"sv, "\\t"sv, "\\r"sv, "{"sv, "}"sv,
+                                                     "["sv, "]"sv, ":"sv, ","sv, "Остановка "sv, " "sv};
+            std::string text;
+            for (size_t i = 0, count = random_() % 12; i < count; ++i) {
+                text += parts[random_() % std::size(parts)];
+            }
+            return text;
+        }
+
+        size_t Position(const std::string& text) {
+            return random_() % (text.size() + 1);
+        }
+
+        // The printed document, or the error
+        static std::string Parse(const std::string& text, unsigned threads) {
+            std::ostringstream output;
+            try {
+                if (threads == 0) {
+                    std::istringstream input(text);
+                    json::Print(json::Load(input), output);
+                } else {
+                    json::Print(json::LoadIndexed(text, threads), output);
+                }
+            } catch (const json::ParsingError&) {
+                return "<parsing error>"s;
+            } catch (const std::exception&) {
+                return "<other error>"s;
+            }
+            return output.str();
+        }
+
+        void Check(const std::string& text, std::string_view kind) {
+            ++checks_;
+            const std::string expected = Parse(text, 0);
+            for (const unsigned threads : {1u, 4u}) {
+                if (const std::string result = Parse(text, threads); result != expected) {
+                    Fail(kind, text, "LoadIndexed on "s + std::to_string(threads) + " threads gives "s + result.substr(0, 200)
+                                         + "\n  Load gives "s + expected.substr(0, 200));
+                }
+            }
+
+            const json::StructuralIndex scalar = json::BuildStructuralIndex(text, json::IndexBackend::SCALAR);
+            for (const auto backend : {json::IndexBackend::SSE2, json::IndexBackend::AVX2}) {
+                // Backends are listed from the narrowest
+                if (backend <= json::GetBestIndexBackend() && json::BuildStructuralIndex(text, backend) != scalar) {
+                    Fail(kind, text, backend == json::IndexBackend::SSE2 ? "SSE2 index differs from the scalar one"s
+                                                                         : "AVX2 index differs from the scalar one"s);
+                }
+            }
+        }
+
+        // The index of a valid document against one found byte by byte
+        void CheckIndexReference(const std::string& text) {
+            json::StructuralIndex expected;
+            bool in_string = false;
+            bool escaped = false;
+            for (size_t i = 0; i < text.size(); ++i) {
+                const char c = text[i];
+                if (in_string) {
+                    if (escaped) {
+                        escaped = false;
+                    } else if (c == '\\') {
+                        escaped = true;
+                    } else if (c == '"') {
+                        in_string = false;
+                        expected.push_back(i);
+                    }
+                } else if (c == '"') {
+                    in_string = true;
+                    expected.push_back(i);
+                } else if ("{}[]:,"sv.find(c) != std::string_view::npos) {
+                    expected.push_back(i);
+                }
+            }
+            if (json::BuildStructuralIndex(text) != expected) {
+                Fail("valid"sv, text, "the index differs from the one found byte by byte"s);
+            }
+        }
+
+        void Fail(std::string_view kind, const std::string& text, const std::string& message) {
+            // The first ones are enough to see what is wrong
+            if (++failures_ <= 10) {
+                std::cerr << "Mismatch on a "sv << kind << " document: "sv << message << "\n  document: "sv
+                          << text.substr(0, 200) << std::endl;
+            }
+        }
+
+        std::mt19937 random_;
+        size_t checks_ = 0;
+        size_t failures_ = 0;
+    };
+
+}  // namespace json_conformance_test
+
+int main(int argc, char* argv[]) {
+    size_t count = 5000;
+    unsigned seed = 42;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i] == "--count"sv && i + 1 < argc) {
+            count = std::strtoul(argv[++i], nullptr, 10);
+        } else if (argv[i] == "--seed"sv && i + 1 < argc) {
+            seed = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (argv[i][0] != '-') {
+            paths.push_back(argv[i]);
+        } else {
+            std::cerr << "Usage: "sv << argv[0] << " [--count <documents>] [--seed <seed>] [<file>...]"sv << std::endl;
+            return 1;
+        }
+    }
+
+    json_conformance_test::Checker checker(seed);
+    for (const std::string& path : paths) {
+        std::ifstream input(path, std::ios::binary);
+        if (!input) {
+            std::cerr << "Cannot open "sv << path << std::endl;
+            return 1;
+        }
+        std::ostringstream text;
+        text << input.rdbuf();
+        checker.CheckAll(text.str());
+    }
+    checker.CheckAll(""s);
+    for (size_t i = 0; i < count; ++i) {
+        checker.CheckAll(checker.MakeValue(0));
+    }
+    for (size_t i = 0; i < count / 100; ++i) {
+        checker.CheckAll(checker.MakeLargeDocument());
+    }
+
+    const json::IndexBackend best = json::GetBestIndexBackend();
+    std::cout << checker.GetChecks() << " documents checked with the scalar"sv
+              << (best >= json::IndexBackend::SSE2 ? ", SSE2"sv : ""sv)
+              << (best >= json::IndexBackend::AVX2 ? ", AVX2"sv : ""sv) << " index, "sv
+              << checker.GetFailures() << " mismatches"sv << std::endl;
+    return checker.GetFailures() == 0 ? 0 : 1;
+}
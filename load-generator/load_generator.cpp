@@ -0,0 +1,234 @@
+// Load generator for the socket server of transport-catalogue (--socket or
+// --port). Every connection sends request lines from a file, keeping up to
+// --pipeline of them unanswered, and times each answer. Reports throughput
+// and latency percentiles.
+//
+//     g++ -std=c++17 -O2 -pthread load_generator.cpp -o load_generator
+//     load_generator --socket /tmp/tc.sock --requests requests.jsonl --connections 8 --pipeline 16 --count 100000
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace load_generator {
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Settings {
+        std::string socket_path;
+        int port = 0;
+        std::string requests_path;
+        size_t connections = 4;
+        size_t pipeline = 16;
+        // Lines are sent over and over until this many are answered, once each if 0
+        size_t count = 0;
+    };
+
+    struct ConnectionResult {
+        // Microseconds from sending a line to receiving its answer
+        std::vector<double> latencies;
+        // Answers without a request_id: the server could not parse or answer the line
+        size_t failed = 0;
+        size_t bytes = 0;
+    };
+
+    int Connect(const Settings& settings) {
+        int fd = -1;
+        if (!settings.socket_path.empty()) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            std::strncpy(address.sun_path, settings.socket_path.c_str(), sizeof(address.sun_path) - 1);
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        } else {
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(static_cast<uint16_t>(settings.port));
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            const int on = 1;
+            if (fd >= 0 && (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0
+                            || connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (fd < 0) {
+            throw std::runtime_error("Cannot connect: "s + std::strerror(errno));
+        }
+        return fd;
+    }
+
+    void SendAll(int fd, std::string_view data) {
+        while (!data.empty()) {
+            const ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Cannot send: "s + std::strerror(errno));
+            }
+            data.remove_prefix(sent);
+        }
+    }
+
+    // Sends lines first, first + step, ... until count of them are answered
+    ConnectionResult RunConnection(const Settings& settings, const std::vector<std::string>& lines,
+                                   size_t first, size_t step, size_t count) {
+        ConnectionResult result;
+        result.latencies.reserve(count);
+        const int fd = Connect(settings);
+
+        std::deque<Clock::time_point> sent_times;
+        std::string input;
+        size_t sent = 0;
+        size_t next = first;
+        char buffer[1 << 16];
+        while (result.latencies.size() < count) {
+            while (sent < count && sent_times.size() < settings.pipeline) {
+                SendAll(fd, lines[next % lines.size()]);
+                next += step;
+                ++sent;
+                sent_times.push_back(Clock::now());
+            }
+
+            const ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                close(fd);
+                throw std::runtime_error("The server closed the connection");
+            }
+            input.append(buffer, received);
+            result.bytes += received;
+
+            size_t start = 0;
+            for (size_t end; (end = input.find('\n', start)) != std::string::npos; start = end + 1) {
+                const auto now = Clock::now();
+                result.latencies.push_back(std::chrono::duration<double, std::micro>(now - sent_times.front()).count());
+                sent_times.pop_front();
+                if (std::string_view(input).substr(start, end - start).find("\"request_id\""sv) == std::string_view::npos) {
+                    ++result.failed;
+                }
+            }
+            input.erase(0, start);
+        }
+        close(fd);
+        return result;
+    }
+
+    double GetPercentile(const std::vector<double>& sorted, double percentile) {
+        if (sorted.empty()) {
+            return 0.;
+        }
+        const size_t index = static_cast<size_t>(percentile / 100. * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    void Run(const Settings& settings) {
+        std::vector<std::string> lines;
+        std::ifstream input(settings.requests_path);
+        for (std::string line; std::getline(input, line);) {
+            if (!line.empty()) {
+                lines.push_back(line + '\n');
+            }
+        }
+        if (lines.empty()) {
+            throw std::runtime_error("No requests in " + settings.requests_path);
+        }
+
+        const size_t total = settings.count > 0 ? settings.count : lines.size();
+        std::vector<ConnectionResult> results(settings.connections);
+        std::vector<std::thread> threads;
+        const auto start = Clock::now();
+        for (size_t i = 0; i < settings.connections; ++i) {
+            // Connections share the total, the first ones take the remainder
+            const size_t count = total / settings.connections + (i < total % settings.connections ? 1 : 0);
+            threads.emplace_back([&, i, count] {
+                try {
+                    results[i] = RunConnection(settings, lines, i, settings.connections, count);
+                } catch (const std::exception& e) {
+                    std::cerr << "Connection "sv << i << ": "sv << e.what() << std::endl;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::vector<double> latencies;
+        size_t failed = 0;
+        size_t bytes = 0;
+        for (const auto& result : results) {
+            latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+            failed += result.failed;
+            bytes += result.bytes;
+        }
+        std::sort(latencies.begin(), latencies.end());
+
+        std::cout << std::fixed << std::setprecision(1)
+                  << "answers:    "sv << latencies.size() << " ("sv << failed << " failed), "sv
+                  << bytes / (1 << 20) << " MiB"sv << '\n'
+                  << "time:       "sv << seconds * 1000 << " ms"sv << '\n'
+                  << "throughput: "sv << latencies.size() / seconds << " requests/s"sv << '\n'
+                  << "latency us: p50 "sv << GetPercentile(latencies, 50.) << ", p99 "sv << GetPercentile(latencies, 99.)
+                  << ", p99.9 "sv << GetPercentile(latencies, 99.9) << ", max "sv
+                  << (latencies.empty() ? 0. : latencies.back()) << std::endl;
+    }
+
+}  // namespace load_generator
+
+int main(int argc, char* argv[]) {
+    load_generator::Settings settings;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string_view option = argv[i];
+        if (option == "--socket"sv) {
+            settings.socket_path = argv[i + 1];
+        } else if (option == "--port"sv) {
+            settings.port = std::atoi(argv[i + 1]);
+        } else if (option == "--requests"sv) {
+            settings.requests_path = argv[i + 1];
+        } else if (option == "--connections"sv) {
+            settings.connections = std::max(1, std::atoi(argv[i + 1]));
+        } else if (option == "--pipeline"sv) {
+            settings.pipeline = std::max(1, std::atoi(argv[i + 1]));
+        } else if (option == "--count"sv) {
+            settings.count = std::max(0, std::atoi(argv[i + 1]));
+        }
+    }
+    if (argc % 2 == 0 || settings.requests_path.empty() || (settings.socket_path.empty() && settings.port == 0)) {
+        std::cerr << "Usage: "sv << argv[0] << " (--socket <path> | --port <port>) --requests <file>"sv
+                  << " [--connections <count>] [--pipeline <count>] [--count <requests>]"sv << std::endl;
+        return 1;
+    }
+
+    try {
+        load_generator::Run(settings);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
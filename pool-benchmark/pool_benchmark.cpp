@@ -0,0 +1,219 @@
+// Benchmark of the schemes answering a skewed mix of requests in parallel
+// with thread_pool::ThreadPool of transport-catalogue: a static split into
+// one range per thread, parts run in batches with a barrier after each,
+// and the pipeline of RequestHandler::AnswerAll, where parts wait in a
+// window of slots and the waiting thread runs pending tasks, stolen ones
+// too. Costs are modelled as sleeps, so the threads overlap as on separate
+// cores even on a machine with fewer of them. The latency of a request is
+// the time until its answer is appended to the output, in order.
+//
+//     cd pool-benchmark && g++ -std=c++17 -O2 -pthread -I../transport-catalogue pool_benchmark.cpp
+//         ../transport-catalogue/thread_pool.cpp -o pool_benchmark
+//     pool_benchmark [--threads 4] [--count 4000] [--repeat 2] [--maps-first]
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+
+namespace pool_benchmark {
+
+    using Clock = std::chrono::steady_clock;
+
+    // Requests in a part and parts in the window of a thread, as in AnswerAll
+    const size_t PART_SIZE = 16;
+    const size_t PARTS_PER_THREAD = 4;
+
+    struct Settings {
+        size_t threads = 4;
+        size_t count = 4000;
+        size_t repeat = 2;
+        // All the maps come in a burst at the start
+        bool maps_first = false;
+    };
+
+    struct Result {
+        double makespan_ms = 0;
+        double p50_ms = 0;
+        double p99_ms = 0;
+    };
+
+    class Benchmark {
+    public:
+        explicit Benchmark(const Settings& settings)
+            : settings_(settings)
+            // The calling thread answers too
+            , pool_(settings.threads - 1) {
+            // 90% Stop and Bus of 20 us, 9% Route of 200 us, 1% Map of 20 ms
+            std::mt19937 random(7);
+            for (size_t i = 0; i < settings.count; ++i) {
+                const unsigned kind = random() % 100;
+                costs_.push_back(std::chrono::microseconds(kind < 90 ? 20 : kind < 99 ? 200 : 20000));
+            }
+            if (settings.maps_first) {
+                std::stable_partition(costs_.begin(), costs_.end(), [](auto cost) {
+                    return cost == std::chrono::microseconds(20000);
+                });
+            }
+        }
+
+        std::chrono::microseconds GetTotalCost() const {
+            std::chrono::microseconds total{0};
+            for (const auto cost : costs_) {
+                total += cost;
+            }
+            return total;
+        }
+
+        // A range of requests per thread, appended when the range is done,
+        // as the requests were answered before the pool had stealing
+        Result RunStaticSplit() {
+            const size_t count = costs_.size();
+            const size_t threads = settings_.threads;
+            std::vector<Clock::time_point> appended(count);
+            const auto start = Clock::now();
+            std::vector<std::future<void>> ranges;
+            for (size_t k = 1; k < threads; ++k) {
+                ranges.push_back(std::async(std::launch::async, [this, k, count, threads] {
+                    AnswerRange(k * count / threads, (k + 1) * count / threads);
+                }));
+            }
+            AnswerRange(0, count / threads);
+            SetAppended(appended, 0, count / threads);
+            for (size_t k = 1; k < threads; ++k) {
+                ranges[k - 1].get();
+                SetAppended(appended, k * count / threads, (k + 1) * count / threads);
+            }
+            return MakeResult(start, appended);
+        }
+
+        // Parts run by ParallelFor a batch at a time
+        Result RunBatches() {
+            const size_t count = costs_.size();
+            const size_t part_count = (count + PART_SIZE - 1) / PART_SIZE;
+            const size_t batch = 2 * settings_.threads;
+            std::vector<Clock::time_point> appended(count);
+            const auto start = Clock::now();
+            for (size_t first = 0; first < part_count; first += batch) {
+                const size_t size = std::min(batch, part_count - first);
+                pool_.ParallelFor(size, [this, first](size_t i) {
+                    AnswerPart(first + i);
+                });
+                SetAppended(appended, first * PART_SIZE, std::min(count, (first + size) * PART_SIZE));
+            }
+            return MakeResult(start, appended);
+        }
+
+        // The scheme of RequestHandler::AnswerAll
+        Result RunPipeline() {
+            const size_t count = costs_.size();
+            const size_t part_count = (count + PART_SIZE - 1) / PART_SIZE;
+            const size_t window = std::min(part_count, PARTS_PER_THREAD * settings_.threads);
+            std::vector<Clock::time_point> appended(count);
+            const auto start = Clock::now();
+            std::deque<std::future<void>> slots(window);
+            const auto submit = [&](size_t part) {
+                slots[part % window] = pool_.Submit([this, part] {
+                    AnswerPart(part);
+                });
+            };
+            for (size_t part = 0; part < window; ++part) {
+                submit(part);
+            }
+            for (size_t part = 0; part < part_count; ++part) {
+                std::future<void>& slot = slots[part % window];
+                while (slot.wait_for(std::chrono::seconds(0)) != std::future_status::ready && pool_.RunPendingTask()) {
+                }
+                slot.get();
+                SetAppended(appended, part * PART_SIZE, std::min(count, (part + 1) * PART_SIZE));
+                if (part + window < part_count) {
+                    submit(part + window);
+                }
+            }
+            return MakeResult(start, appended);
+        }
+
+    private:
+        void AnswerRange(size_t begin, size_t end) const {
+            for (size_t i = begin; i < end; ++i) {
+                std::this_thread::sleep_for(costs_[i]);
+            }
+        }
+
+        void AnswerPart(size_t part) const {
+            AnswerRange(part * PART_SIZE, std::min(costs_.size(), (part + 1) * PART_SIZE));
+        }
+
+        static void SetAppended(std::vector<Clock::time_point>& appended, size_t begin, size_t end) {
+            const auto now = Clock::now();
+            std::fill(appended.begin() + begin, appended.begin() + end, now);
+        }
+
+        static Result MakeResult(Clock::time_point start, const std::vector<Clock::time_point>& appended) {
+            std::vector<double> latencies;
+            latencies.reserve(appended.size());
+            for (const auto time : appended) {
+                latencies.push_back(std::chrono::duration<double, std::milli>(time - start).count());
+            }
+            std::sort(latencies.begin(), latencies.end());
+            return {latencies.back(), latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]};
+        }
+
+        Settings settings_;
+        std::vector<std::chrono::microseconds> costs_;
+        thread_pool::ThreadPool pool_;
+    };
+
+    void Print(std::string_view name, const Result& result) {
+        std::cout << "  "sv << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(1)
+                  << "makespan "sv << std::setw(7) << result.makespan_ms << " ms, latency p50 "sv << std::setw(7)
+                  << result.p50_ms << " ms, p99 "sv << std::setw(7) << result.p99_ms << " ms"sv << std::endl;
+    }
+
+}  // namespace pool_benchmark
+
+int main(int argc, char* argv[]) {
+    pool_benchmark::Settings settings;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i] == "--threads"sv && i + 1 < argc) {
+            settings.threads = std::strtoul(argv[++i], nullptr, 10);
+        } else if (argv[i] == "--count"sv && i + 1 < argc) {
+            settings.count = std::strtoul(argv[++i], nullptr, 10);
+        } else if (argv[i] == "--repeat"sv && i + 1 < argc) {
+            settings.repeat = std::strtoul(argv[++i], nullptr, 10);
+        } else if (argv[i] == "--maps-first"sv) {
+            settings.maps_first = true;
+        } else {
+            std::cerr << "Usage: "sv << argv[0] << " [--threads 4] [--count 4000] [--repeat 2] [--maps-first]"sv
+                      << std::endl;
+            return 1;
+        }
+    }
+    if (settings.threads == 0 || settings.count == 0) {
+        std::cerr << "There must be a thread and a request"sv << std::endl;
+        return 1;
+    }
+
+    pool_benchmark::Benchmark benchmark(settings);
+    const double total_ms = std::chrono::duration<double, std::milli>(benchmark.GetTotalCost()).count();
+    std::cout << (settings.maps_first ? "Maps first: "sv : "Mixed: "sv) << settings.count << " requests, "sv
+              << std::fixed << std::setprecision(1) << total_ms << " ms of work, at best "sv
+              << total_ms / settings.threads << " ms on "sv << settings.threads << " threads"sv << std::endl;
+    for (size_t i = 0; i < settings.repeat; ++i) {
+        pool_benchmark::Print("static split"sv, benchmark.RunStaticSplit());
+        pool_benchmark::Print("batches + barrier"sv, benchmark.RunBatches());
+        pool_benchmark::Print("stealing pipeline"sv, benchmark.RunPipeline());
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+// Test of the trace of transport-catalogue written by trace::Write. Spans
+// begun before trace::Start, ending before their start and taking no time
+// must give a valid json document with the times written exactly: the
+// start may be negative, the duration is 0 at least.
+//
+//     cd trace-test && g++ -std=c++17 -O2 -pthread -I../transport-catalogue trace_test.cpp
+//         ../transport-catalogue/trace.cpp ../transport-catalogue/json.cpp ../transport-catalogue/json_builder.cpp
+//         ../transport-catalogue/json_index.cpp -o trace_test
+//     trace_test
+
+#include "json.h"
+#include "trace.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+using namespace std::literals;
+
+namespace trace_test {
+
+    class Checker {
+    public:
+        explicit Checker(const json::Array& events)
+            : events_(events) {
+        }
+
+        // The span of the name must have these times, in microseconds
+        void Check(std::string_view name, double ts, double dur) {
+            for (const json::Node& event : events_) {
+                const json::Dict& data = event.AsMap();
+                if (data.at("name"s).AsString() != name) {
+                    continue;
+                }
+                const double event_ts = data.at("ts"s).AsDouble();
+                const double event_dur = data.at("dur"s).AsDouble();
+                // The start is known within the time Start took to read the clock
+                if (std::abs(event_ts - ts) > 50. || event_dur != dur) {
+                    Fail("Span "s + std::string(name) + " has ts "s + std::to_string(event_ts) + ", dur "s
+                         + std::to_string(event_dur) + ", expected about "s + std::to_string(ts) + " and "s
+                         + std::to_string(dur));
+                }
+                return;
+            }
+            Fail("No span "s + std::string(name));
+        }
+
+        void Fail(const std::string& message) {
+            ++failures_;
+            std::cerr << message << std::endl;
+        }
+
+        size_t GetFailures() const {
+            return failures_;
+        }
+
+    private:
+        const json::Array& events_;
+        size_t failures_ = 0;
+    };
+
+}  // namespace trace_test
+
+int main() {
+    using trace::Clock;
+    const auto before_start = Clock::now() - 1234567ns;
+    trace::Start();
+    const auto start = Clock::now();
+    trace::AddSpan("before_start"sv, "test"sv, before_start, before_start + 1500ns);
+    trace::AddSpan("negative"sv, "test"sv, start, start - 3ns, -1);
+    trace::AddSpan("zero"sv, "test"sv, start, start);
+    trace::AddSpan("fraction"sv, "test"sv, start, start + 1007ns);
+
+    std::ostringstream output;
+    trace::Write(output);
+    std::istringstream input(output.str());
+    try {
+        const json::Document document = json::Load(input);
+        trace_test::Checker checker(document.GetRoot().AsMap().at("traceEvents"s).AsArray());
+        checker.Check("before_start"sv, -1234.567, 1.5);
+        checker.Check("negative"sv, 0., 0.);
+        checker.Check("zero"sv, 0., 0.);
+        checker.Check("fraction"sv, 0., 1.007);
+        std::cout << "4 spans checked, "sv << checker.GetFailures() << " failures"sv << std::endl;
+        return checker.GetFailures() == 0 ? 0 : 1;
+    } catch (const json::ParsingError& error) {
+        std::cerr << "The trace is not valid json: "sv << error.what() << '\n' << output.str() << std::endl;
+        return 1;
+    }
+}
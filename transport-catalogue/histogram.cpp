@@ -0,0 +1,82 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace histogram {
+
+    size_t LogHistogram::GetBucket(uint64_t value) {
+        if (value < SUB_BUCKET_COUNT) {
+            return static_cast<size_t>(value);
+        }
+        // The highest bit picks the power of two, the bits after it the sub-bucket
+        const size_t power = 63 - __builtin_clzll(value);
+        const size_t shift = power - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKET_COUNT + static_cast<size_t>((value >> shift) & (SUB_BUCKET_COUNT - 1));
+    }
+
+    uint64_t LogHistogram::GetBucketValue(size_t bucket) {
+        if (bucket < SUB_BUCKET_COUNT) {
+            return bucket;
+        }
+        const size_t shift = bucket / SUB_BUCKET_COUNT - 1;
+        const uint64_t lowest = (SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+        return lowest + ((uint64_t(1) << shift) - 1);
+    }
+
+    void LogHistogram::Add(uint64_t value) {
+        ++counts_[GetBucket(value)];
+        ++count_;
+        max_ = std::max(max_, value);
+    }
+
+    void LogHistogram::AddToBucket(size_t bucket, uint64_t count) {
+        if (count == 0) {
+            return;
+        }
+        counts_[bucket] += count;
+        count_ += count;
+        max_ = std::max(max_, GetBucketValue(bucket));
+    }
+
+    void LogHistogram::SetMax(uint64_t max) {
+        max_ = max;
+    }
+
+    void LogHistogram::Subtract(const LogHistogram& other) {
+        count_ = 0;
+        uint64_t max = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            counts_[i] -= std::min(counts_[i], other.counts_[i]);
+            count_ += counts_[i];
+            if (counts_[i] > 0) {
+                max = GetBucketValue(i);
+            }
+        }
+        max_ = std::min(max_, max);
+    }
+
+    uint64_t LogHistogram::GetCount() const {
+        return count_;
+    }
+
+    uint64_t LogHistogram::GetMax() const {
+        return max_;
+    }
+
+    uint64_t LogHistogram::GetPercentile(double percent) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percent / 100. * count_)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(GetBucketValue(i), max_);
+            }
+        }
+        return max_;
+    }
+
+}  // namespace histogram
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace histogram {
+
+    // Counts of values in buckets growing exponentially, as HdrHistogram
+    // does: values below SUB_BUCKET_COUNT have a bucket each, every power of
+    // two above is split into SUB_BUCKET_COUNT buckets. A value is known
+    // within 1/16 of it over the whole range of uint64_t.
+    class LogHistogram {
+    public:
+        static constexpr size_t SUB_BUCKET_BITS = 4;
+        static constexpr size_t SUB_BUCKET_COUNT = size_t(1) << SUB_BUCKET_BITS;
+        static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+        static size_t GetBucket(uint64_t value);
+        // The highest value put into the bucket
+        static uint64_t GetBucketValue(size_t bucket);
+
+        void Add(uint64_t value);
+        // For histograms counted elsewhere, e.g. by other threads
+        void AddToBucket(size_t bucket, uint64_t count);
+        void SetMax(uint64_t max);
+        // The counts of the other histogram taken away, it must hold a part
+        // of these values. The max is known within a bucket after that.
+        void Subtract(const LogHistogram& other);
+
+        uint64_t GetCount() const;
+        // The highest value, exact if it was given by Add or SetMax
+        uint64_t GetMax() const;
+        // The value which percent of the values are not above, within the
+        // precision of the buckets. 0 for an empty histogram.
+        uint64_t GetPercentile(double percent) const;
+
+    private:
+        std::array<uint64_t, BUCKET_COUNT> counts_ = {};
+        uint64_t count_ = 0;
+        uint64_t max_ = 0;
+    };
+
+}  // namespace histogram
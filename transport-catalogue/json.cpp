@@ -1,14 +1,22 @@
 #include "json.h"
+#include "json_index.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <future>
 #include <iterator>
+#include <optional>
 
 namespace json {
 
 namespace {
 using namespace std::literals;
 
-Node LoadNode(std::istream& input);
-Node LoadString(std::istream& input);
+using Resource = std::pmr::memory_resource;
+
+Node LoadNode(std::istream& input, Resource* resource);
+String LoadStringValue(std::istream& input, Resource* resource);
 
 std::string LoadLiteral(std::istream& input) {
     std::string s;
@@ -18,32 +26,87 @@ std::string LoadLiteral(std::istream& input) {
     return s;
 }
 
-Node LoadArray(std::istream& input) {
-    std::vector<Node> result;
+// Items of the arrays and dicts being parsed. Items of a container are
+// collected on top of the stack, so the container itself is allocated
+// once with exact size.
+thread_local std::vector<Node> array_items;
+thread_local std::vector<Dict::value_type> dict_items;
+
+// Drops items left on the stack by the container being parsed
+template <typename Items>
+class ItemsGuard {
+public:
+    explicit ItemsGuard(Items& items)
+        : items_(items)
+        , first_(items.size()) {
+    }
+
+    ~ItemsGuard() {
+        items_.erase(items_.begin() + first_, items_.end());
+    }
+
+    size_t First() const {
+        return first_;
+    }
+
+private:
+    Items& items_;
+    size_t first_;
+};
+
+// Makes the dict of the items on top of the stack from the first one.
+// They are sorted once, so every key is appended to the dict, and
+// duplicates end up next to each other.
+Dict MakeDict(size_t first, Resource* resource) {
+    const auto begin = dict_items.begin() + first;
+    const auto less = [](const Dict::value_type& lhs, const Dict::value_type& rhs) {
+        return lhs.first < rhs.first;
+    };
+    if (!std::is_sorted(begin, dict_items.end(), less)) {
+        std::sort(begin, dict_items.end(), less);
+    }
+    if (const auto it = std::adjacent_find(begin, dict_items.end(),
+            [](const Dict::value_type& lhs, const Dict::value_type& rhs) {
+                return lhs.first == rhs.first;
+            }); it != dict_items.end()) {
+        throw ParsingError("Duplicate key '"s + std::string(it->first) + "' have been found");
+    }
+
+    Dict dict(resource);
+    dict.reserve(dict_items.end() - begin);
+    for (auto it = begin; it != dict_items.end(); ++it) {
+        dict.emplace(std::move(it->first), std::move(it->second));
+    }
+    return dict;
+}
+
+Node LoadArray(std::istream& input, Resource* resource) {
+    ItemsGuard guard(array_items);
 
     for (char c; input >> c && c != ']';) {
         if (c != ',') {
             input.putback(c);
         }
-        result.push_back(LoadNode(input));
+        array_items.push_back(LoadNode(input, resource));
     }
     if (!input) {
         throw ParsingError("Array parsing error"s);
     }
+
+    Array result(resource);
+    result.reserve(array_items.size() - guard.First());
+    std::move(array_items.begin() + guard.First(), array_items.end(), std::back_inserter(result));
     return Node(std::move(result));
 }
 
-Node LoadDict(std::istream& input) {
-    Dict dict;
+Node LoadDict(std::istream& input, Resource* resource) {
+    ItemsGuard guard(dict_items);
 
     for (char c; input >> c && c != '}';) {
         if (c == '"') {
-            std::string key = LoadString(input).AsString();
+            String key = LoadStringValue(input, resource);
             if (input >> c && c == ':') {
-                if (dict.find(key) != dict.end()) {
-                    throw ParsingError("Duplicate key '"s + key + "' have been found");
-                }
-                dict.emplace(std::move(key), LoadNode(input));
+                dict_items.emplace_back(std::move(key), LoadNode(input, resource));
             } else {
                 throw ParsingError(": is expected but '"s + c + "' has been found"s);
             }
@@ -54,13 +117,17 @@ Node LoadDict(std::istream& input) {
     if (!input) {
         throw ParsingError("Dictionary parsing error"s);
     }
-    return Node(std::move(dict));
+
+    return Node(MakeDict(guard.First(), resource));
 }
 
-Node LoadString(std::istream& input) {
+String LoadStringValue(std::istream& input, Resource* resource) {
+    // Characters are collected in a reusable buffer, so the arena gets
+    // a single allocation of the final size
+    thread_local std::string s;
+    s.clear();
     auto it = std::istreambuf_iterator<char>(input);
     auto end = std::istreambuf_iterator<char>();
-    std::string s;
     while (true) {
         if (it == end) {
             throw ParsingError("String parsing error");
@@ -102,7 +169,11 @@ Node LoadString(std::istream& input) {
         ++it;
     }
 
-    return Node(std::move(s));
+    return String(s, resource);
+}
+
+Node LoadString(std::istream& input, Resource* resource) {
+    return Node(LoadStringValue(input, resource));
 }
 
 Node LoadBool(std::istream& input) {
@@ -190,18 +261,18 @@ Node LoadNumber(std::istream& input) {
     }
 }
 
-Node LoadNode(std::istream& input) {
+Node LoadNode(std::istream& input, Resource* resource) {
     char c;
     if (!(input >> c)) {
         throw ParsingError("Unexpected EOF"s);
     }
     switch (c) {
         case '[':
-            return LoadArray(input);
+            return LoadArray(input, resource);
         case '{':
-            return LoadDict(input);
+            return LoadDict(input, resource);
         case '"':
-            return LoadString(input);
+            return LoadString(input, resource);
         case 't':
             // Атрибут [[fallthrough]] (провалиться) ничего не делает, и является
             // подсказкой компилятору и человеку, что здесь программист явно задумывал
@@ -222,6 +293,400 @@ Node LoadNode(std::istream& input) {
     }
 }
 
+// Stage two of the two-stage parser: builds nodes from the text, taking
+// strings and containers boundaries from the structural index
+class IndexedParser {
+public:
+    IndexedParser(std::string_view text, const StructuralIndex& index, Resource* resource)
+        : text_(text)
+        , index_(index)
+        , resource_(resource) {
+    }
+
+    // Large arrays near the root are split between threads, the arenas of
+    // the other threads are added to the list
+    IndexedParser(std::string_view text, const StructuralIndex& index, Document::Arenas& arenas,
+                  unsigned threads)
+        : IndexedParser(text, index, arenas.front().get()) {
+        arenas_ = &arenas;
+        threads_ = threads;
+    }
+
+    Node ParseValue() {
+        const size_t pos = SkipSpaces(pos_);
+        if (pos == text_.size()) {
+            throw ParsingError("Unexpected EOF"s);
+        }
+        switch (text_[pos]) {
+            case '[':
+                Consume(pos);
+                return ParseArray();
+            case '{':
+                Consume(pos);
+                return ParseDict();
+            case '"':
+                Consume(pos);
+                return Node(ParseString());
+            case 't':
+                [[fallthrough]];
+            case 'f':
+                return ParseBool(pos);
+            case 'n':
+                return ParseNull(pos);
+            default:
+                return ParseNumber(pos);
+        }
+    }
+
+private:
+    // The root array and the arrays right in the root container
+    static constexpr size_t PARALLEL_MAX_DEPTH = 1;
+    // Starting a thread for fewer items takes longer than parsing them
+    static constexpr size_t PARALLEL_MIN_ITEMS = 512;
+
+    // The same characters std::isspace, std::isalpha and std::isdigit
+    // accept in the "C" locale, without a call per character
+    static bool IsSpace(char c) {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+    }
+
+    static bool IsAlpha(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    static bool IsDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    size_t SkipSpaces(size_t pos) const {
+        while (pos < text_.size() && IsSpace(text_[pos])) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    // Takes the next index entry, which must point at pos
+    void Consume(size_t pos) {
+        if (next_ == index_.size() || index_[next_] != pos) {
+            throw ParsingError("Unexpected character '"s + text_[pos] + "'"s);
+        }
+        ++next_;
+        pos_ = pos + 1;
+    }
+
+    // Takes the next structural character, only spaces may precede it.
+    // Returns 0 at the end of the text.
+    char NextStructural() {
+        const size_t pos = SkipSpaces(pos_);
+        if (pos == text_.size()) {
+            return 0;
+        }
+        Consume(pos);
+        return text_[pos];
+    }
+
+    // Separators are handled the same way LoadArray does
+    Node ParseArray() {
+        if (threads_ > 1 && depth_ <= PARALLEL_MAX_DEPTH) {
+            if (auto result = TryParseArrayParallel()) {
+                return std::move(*result);
+            }
+        }
+
+        ItemsGuard guard(array_items);
+        ++depth_;
+
+        while (true) {
+            const size_t pos = SkipSpaces(pos_);
+            if (pos == text_.size()) {
+                throw ParsingError("Array parsing error"s);
+            }
+            if (text_[pos] == ']') {
+                Consume(pos);
+                break;
+            }
+            if (text_[pos] == ',') {
+                Consume(pos);
+            }
+            array_items.push_back(ParseValue());
+        }
+
+        --depth_;
+        Array result(resource_);
+        result.reserve(array_items.size() - guard.First());
+        std::move(array_items.begin() + guard.First(), array_items.end(), std::back_inserter(result));
+        return Node(std::move(result));
+    }
+
+    // Index entries of the '[' just consumed, of the commas between the
+    // items and of the closing ']'. Empty if the array is not closed.
+    std::vector<size_t> FindItemBounds() const {
+        std::vector<size_t> bounds{next_ - 1};
+        size_t depth = 0;
+        for (size_t i = next_; i < index_.size(); ++i) {
+            switch (text_[index_[i]]) {
+                case '[':
+                    [[fallthrough]];
+                case '{':
+                    ++depth;
+                    break;
+                case ']':
+                    if (depth == 0) {
+                        bounds.push_back(i);
+                        return bounds;
+                    }
+                    --depth;
+                    break;
+                case '}':
+                    if (depth == 0) {
+                        return {};
+                    }
+                    --depth;
+                    break;
+                case ',':
+                    if (depth == 0) {
+                        bounds.push_back(i);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        return {};
+    }
+
+    // Items [first, last) of the array, each must take exactly the text
+    // between its bounds
+    std::vector<Node> ParseItems(const std::vector<size_t>& bounds, size_t first, size_t last,
+                                 Resource* resource) const {
+        IndexedParser parser(text_, index_, resource);
+        std::vector<Node> items;
+        items.reserve(last - first);
+        for (size_t i = first; i < last; ++i) {
+            parser.next_ = bounds[i] + 1;
+            parser.pos_ = index_[bounds[i]] + 1;
+            items.push_back(parser.ParseValue());
+            if (parser.next_ != bounds[i + 1] || parser.SkipSpaces(parser.pos_) != index_[bounds[i + 1]]) {
+                throw ParsingError("Array parsing error"s);
+            }
+        }
+        return items;
+    }
+
+    // The '[' is consumed. Gives nothing if the array is small or is not a
+    // plain comma separated list, then ParseArray handles it and its errors.
+    std::optional<Node> TryParseArrayParallel() {
+        const std::vector<size_t> bounds = FindItemBounds();
+        const size_t count = bounds.empty() ? 0 : bounds.size() - 1;
+        const size_t threads = std::min<size_t>(threads_, count / PARALLEL_MIN_ITEMS);
+        if (threads < 2) {
+            return std::nullopt;
+        }
+        auto chunk_begin = [count, threads](size_t chunk) {
+            return count * chunk / threads;
+        };
+
+        // Declared in this order, so the items are released before their arenas
+        Document::Arenas arenas;
+        std::vector<std::future<std::vector<Node>>> futures;
+        std::vector<std::vector<Node>> chunks;
+        try {
+            for (size_t chunk = 1; chunk < threads; ++chunk) {
+                Resource* resource = arenas.emplace_back(std::make_unique<Document::Arena>()).get();
+                futures.push_back(std::async(std::launch::async, [this, &bounds, chunk_begin, chunk, resource] {
+                    return ParseItems(bounds, chunk_begin(chunk), chunk_begin(chunk + 1), resource);
+                }));
+            }
+            chunks.push_back(ParseItems(bounds, 0, chunk_begin(1), resource_));
+            for (auto& future : futures) {
+                chunks.push_back(future.get());
+            }
+        } catch (const ParsingError&) {
+            return std::nullopt;
+        }
+
+        Array result(resource_);
+        result.reserve(count);
+        for (auto& items : chunks) {
+            std::move(items.begin(), items.end(), std::back_inserter(result));
+        }
+        std::move(arenas.begin(), arenas.end(), std::back_inserter(*arenas_));
+        next_ = bounds.back() + 1;
+        pos_ = index_[bounds.back()] + 1;
+        return Node(std::move(result));
+    }
+
+    // Separators are handled the same way LoadDict does
+    Node ParseDict() {
+        ItemsGuard guard(dict_items);
+        ++depth_;
+
+        char c;
+        while ((c = NextStructural()) && c != '}') {
+            if (c == '"') {
+                String key = ParseString();
+                if (c = NextStructural(); c == ':') {
+                    dict_items.emplace_back(std::move(key), ParseValue());
+                } else {
+                    throw ParsingError(": is expected but '"s + c + "' has been found"s);
+                }
+            } else if (c != ',') {
+                throw ParsingError(R"(',' is expected but ')"s + c + "' has been found"s);
+            }
+        }
+        if (c != '}') {
+            throw ParsingError("Dictionary parsing error"s);
+        }
+
+        --depth_;
+        return Node(MakeDict(guard.First(), resource_));
+    }
+
+    // The opening quote is consumed, the next index entry is the closing one
+    String ParseString() {
+        if (next_ == index_.size()) {
+            throw ParsingError("String parsing error"s);
+        }
+        const size_t begin = pos_;
+        const size_t end = index_[next_];
+        Consume(end);
+        const std::string_view raw = text_.substr(begin, end - begin);
+
+        if (raw.find_first_of("\\\n\r"sv) == std::string_view::npos) {
+            return String(raw, resource_);
+        }
+
+        thread_local std::string s;
+        s.clear();
+        for (size_t i = 0; i < raw.size(); ++i) {
+            const char ch = raw[i];
+            if (ch == '\\') {
+                // The closing quote is never escaped, so the escape has its pair
+                const char escaped_char = raw[++i];
+                switch (escaped_char) {
+                    case 'n':
+                        s.push_back('\n');
+                        break;
+                    case 't':
+                        s.push_back('\t');
+                        break;
+                    case 'r':
+                        s.push_back('\r');
+                        break;
+                    case '"':
+                        s.push_back('"');
+                        break;
+                    case '\\':
+                        s.push_back('\\');
+                        break;
+                    default:
+                        throw ParsingError("Unrecognized escape sequence \\"s + escaped_char);
+                }
+            } else if (ch == '\n' || ch == '\r') {
+                throw ParsingError("Unexpected end of line"s);
+            } else {
+                s.push_back(ch);
+            }
+        }
+        return String(s, resource_);
+    }
+
+    std::string_view ParseLiteral(size_t pos) {
+        size_t end = pos;
+        while (end < text_.size() && IsAlpha(text_[end])) {
+            ++end;
+        }
+        pos_ = end;
+        return text_.substr(pos, end - pos);
+    }
+
+    Node ParseBool(size_t pos) {
+        const auto s = ParseLiteral(pos);
+        if (s == "true"sv) {
+            return Node{true};
+        } else if (s == "false"sv) {
+            return Node{false};
+        } else {
+            throw ParsingError("Failed to parse '"s + std::string(s) + "' as bool"s);
+        }
+    }
+
+    Node ParseNull(size_t pos) {
+        if (auto literal = ParseLiteral(pos); literal == "null"sv) {
+            return Node{nullptr};
+        } else {
+            throw ParsingError("Failed to parse '"s + std::string(literal) + "' as null"s);
+        }
+    }
+
+    // Accepts the same grammar and gives the same values as LoadNumber
+    Node ParseNumber(size_t pos) {
+        size_t end = pos;
+        auto is_digit = [this](size_t i) {
+            return i < text_.size() && IsDigit(text_[i]);
+        };
+        auto read_digits = [&end, is_digit] {
+            if (!is_digit(end)) {
+                throw ParsingError("A digit is expected"s);
+            }
+            while (is_digit(end)) {
+                ++end;
+            }
+        };
+
+        if (text_[end] == '-') {
+            ++end;
+        }
+        if (end < text_.size() && text_[end] == '0') {
+            ++end;
+        } else {
+            read_digits();
+        }
+
+        bool is_int = true;
+        if (end < text_.size() && text_[end] == '.') {
+            ++end;
+            read_digits();
+            is_int = false;
+        }
+        if (end < text_.size() && (text_[end] == 'e' || text_[end] == 'E')) {
+            ++end;
+            if (end < text_.size() && (text_[end] == '+' || text_[end] == '-')) {
+                ++end;
+            }
+            read_digits();
+            is_int = false;
+        }
+        pos_ = end;
+
+        const char* first = text_.data() + pos;
+        const char* last = text_.data() + end;
+        if (is_int) {
+            int value;
+            if (auto result = std::from_chars(first, last, value); result.ec == std::errc{}) {
+                return value;
+            }
+            // In case of overflow the number is parsed as double below
+        }
+        double value;
+        if (auto result = std::from_chars(first, last, value); result.ec != std::errc{}) {
+            throw ParsingError("Failed to convert "s + std::string(first, last) + " to number"s);
+        }
+        return value;
+    }
+
+    std::string_view text_;
+    const StructuralIndex& index_;
+    Resource* resource_;
+    Document::Arenas* arenas_ = nullptr;
+    unsigned threads_ = 1;
+    // The next index entry and the position in the text to parse from
+    size_t next_ = 0;
+    size_t pos_ = 0;
+    // Containers open around the value being parsed
+    size_t depth_ = 0;
+};
+
 struct PrintContext {
     std::ostream& out;
     int indent_step = 4;
@@ -245,7 +710,7 @@ void PrintValue(const Value& value, const PrintContext& ctx) {
     ctx.out << value;
 }
 
-void PrintString(const std::string& value, std::ostream& out) {
+void PrintString(std::string_view value, std::ostream& out) {
     out.put('"');
     for (const char c : value) {
         switch (c) {
@@ -270,7 +735,7 @@ void PrintString(const std::string& value, std::ostream& out) {
 }
 
 template <>
-void PrintValue<std::string>(const std::string& value, const PrintContext& ctx) {
+void PrintValue<String>(const String& value, const PrintContext& ctx) {
     PrintString(value, ctx.out);
 }
 
@@ -342,7 +807,17 @@ void PrintNode(const Node& node, const PrintContext& ctx) {
 }  // namespace
 
 Document Load(std::istream& input) {
-    return Document{LoadNode(input)};
+    auto arena = std::make_unique<Document::Arena>();
+    Node root = LoadNode(input, arena.get());
+    return Document{std::move(arena), std::move(root)};
+}
+
+Document LoadIndexed(std::string_view text, unsigned threads) {
+    const StructuralIndex index = BuildStructuralIndex(text);
+    Document::Arenas arenas;
+    arenas.push_back(std::make_unique<Document::Arena>());
+    Node root = IndexedParser(text, index, arenas, threads).ParseValue();
+    return Document{std::move(arenas), std::move(root)};
 }
 
 void Print(const Document& doc, std::ostream& output) {
@@ -1,16 +1,62 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
-#include <map>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <variant>
 #include <vector>
 
 namespace json {
 
 class Node;
-using Dict = std::map<std::string, Node>;
-using Array = std::vector<Node>;
+// Strings and containers take memory from a polymorphic allocator, so a
+// parsed document lives in the arena of its json::Document
+using String = std::pmr::string;
+using Array = std::pmr::vector<Node>;
+
+// JSON object stored as a flat vector of key/value pairs sorted by key.
+// Objects are mostly small, so this takes a single allocation per object
+// instead of one per key, and keys are iterated in the same order as
+// with std::map. Keys must not be changed through iterators.
+class Dict {
+public:
+    using value_type = std::pair<String, Node>;
+    using iterator = std::pmr::vector<value_type>::iterator;
+    using const_iterator = std::pmr::vector<value_type>::const_iterator;
+
+    Dict() = default;
+    explicit Dict(std::pmr::memory_resource* resource);
+
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+    size_t size() const;
+    bool empty() const;
+    void reserve(size_t size);
+
+    iterator find(std::string_view key);
+    const_iterator find(std::string_view key) const;
+    size_t count(std::string_view key) const;
+    Node& at(std::string_view key);
+    const Node& at(std::string_view key) const;
+    Node& operator[](std::string_view key);
+    std::pair<iterator, bool> emplace(String key, Node value);
+
+    bool operator==(const Dict& rhs) const;
+
+private:
+    // Up to this size keys are looked up with a linear scan
+    static const size_t LINEAR_SEARCH_SIZE = 8;
+
+    iterator LowerBound(std::string_view key);
+    std::pmr::vector<value_type> items_;
+};
 
 class ParsingError : public std::runtime_error {
 public:
@@ -18,11 +64,18 @@ public:
 };
 
 class Node final
-    : private std::variant<std::nullptr_t, Array, Dict, bool, int, double, std::string> {
+    : private std::variant<std::nullptr_t, Array, Dict, bool, int, double, String> {
 public:
     using variant::variant;
     using Value = variant;
 
+    Node(const std::string& value)
+        : variant(String(value)) {
+    }
+    Node(std::string_view value)
+        : variant(String(value)) {
+    }
+
     bool IsInt() const {
         return std::holds_alternative<int>(*this);
     }
@@ -77,15 +130,15 @@ public:
     }
 
     bool IsString() const {
-        return std::holds_alternative<std::string>(*this);
+        return std::holds_alternative<String>(*this);
     }
-    const std::string& AsString() const {
+    const String& AsString() const {
         using namespace std::literals;
         if (!IsString()) {
             throw std::logic_error("Not a string"s);
         }
 
-        return std::get<std::string>(*this);
+        return std::get<String>(*this);
     }
 
     bool IsMap() const {
@@ -117,18 +170,150 @@ inline bool operator!=(const Node& lhs, const Node& rhs) {
     return !(lhs == rhs);
 }
 
+inline Dict::Dict(std::pmr::memory_resource* resource)
+    : items_(resource) {
+}
+
+inline Dict::iterator Dict::begin() {
+    return items_.begin();
+}
+
+inline Dict::iterator Dict::end() {
+    return items_.end();
+}
+
+inline Dict::const_iterator Dict::begin() const {
+    return items_.begin();
+}
+
+inline Dict::const_iterator Dict::end() const {
+    return items_.end();
+}
+
+inline size_t Dict::size() const {
+    return items_.size();
+}
+
+inline bool Dict::empty() const {
+    return items_.empty();
+}
+
+inline void Dict::reserve(size_t size) {
+    items_.reserve(size);
+}
+
+inline Dict::iterator Dict::LowerBound(std::string_view key) {
+    return std::lower_bound(items_.begin(), items_.end(), key,
+        [](const value_type& item, std::string_view key) {
+            return item.first < key;
+        });
+}
+
+inline Dict::iterator Dict::find(std::string_view key) {
+    if (items_.size() <= LINEAR_SEARCH_SIZE) {
+        return std::find_if(items_.begin(), items_.end(),
+            [key](const value_type& item) {
+                return item.first == key;
+            });
+    }
+    auto it = LowerBound(key);
+    return it != items_.end() && it->first == key ? it : items_.end();
+}
+
+inline Dict::const_iterator Dict::find(std::string_view key) const {
+    return const_cast<Dict*>(this)->find(key);
+}
+
+inline size_t Dict::count(std::string_view key) const {
+    return find(key) == end() ? 0 : 1;
+}
+
+inline Node& Dict::at(std::string_view key) {
+    using namespace std::literals;
+    auto it = find(key);
+    if (it == end()) {
+        throw std::out_of_range("Key not found in dict"s);
+    }
+    return it->second;
+}
+
+inline const Node& Dict::at(std::string_view key) const {
+    return const_cast<Dict*>(this)->at(key);
+}
+
+inline Node& Dict::operator[](std::string_view key) {
+    if (auto it = find(key); it != end()) {
+        return it->second;
+    }
+    return emplace(String(key, items_.get_allocator()), Node{}).first->second;
+}
+
+inline std::pair<Dict::iterator, bool> Dict::emplace(String key, Node value) {
+    // Keys usually come already sorted, then the pair is just appended
+    auto it = items_.empty() || items_.back().first < key ? items_.end() : LowerBound(key);
+    if (it != items_.end() && it->first == key) {
+        return {it, false};
+    }
+    it = items_.emplace(it, std::move(key), std::move(value));
+    return {it, true};
+}
+
+inline bool Dict::operator==(const Dict& rhs) const {
+    return items_ == rhs.items_;
+}
+
+// Document either owns a root built elsewhere or, when it comes from
+// json::Load, the arena the whole tree was allocated from. In the latter
+// case nodes are not destroyed one by one: the arena is released at once.
+// Copies of the nodes taken from the document use the default allocator.
 class Document {
 public:
+    using Arena = std::pmr::monotonic_buffer_resource;
+    using Arenas = std::vector<std::unique_ptr<Arena>>;
+
     explicit Document(Node root)
-        : root_(std::move(root)) {
+        : root_(new Node(std::move(root)), RootDeleter{false}) {
+    }
+
+    Document(std::unique_ptr<Arena> arena, Node root)
+        : Document(MakeArenas(std::move(arena)), std::move(root)) {
+    }
+
+    // Nodes parsed on several threads live in several arenas, the root is
+    // placed into the first one
+    Document(Arenas arenas, Node root)
+        : arenas_(std::move(arenas))
+        , root_(MakeArenaRoot(*arenas_.front(), std::move(root)), RootDeleter{true}) {
     }
 
     const Node& GetRoot() const {
-        return root_;
+        return *root_;
     }
 
 private:
-    Node root_;
+    struct RootDeleter {
+        bool in_arena = false;
+
+        void operator()(Node* node) const {
+            if (!in_arena) {
+                delete node;
+            }
+        }
+    };
+
+    static Arenas MakeArenas(std::unique_ptr<Arena> arena) {
+        Arenas arenas;
+        arenas.push_back(std::move(arena));
+        return arenas;
+    }
+
+    static Node* MakeArenaRoot(Arena& arena, Node root) {
+        return new (arena.allocate(sizeof(Node), alignof(Node))) Node(std::move(root));
+    }
+
+    // The root is declared after the arenas, so it is released first
+    Arenas arenas_;
+    std::unique_ptr<Node, RootDeleter> root_;
 };
 
 inline bool operator==(const Document& lhs, const Document& rhs) {
@@ -141,6 +326,13 @@ inline bool operator!=(const Document& lhs, const Document& rhs) {
 
 Document Load(std::istream& input);
 
+// Two-stage parser for large texts: the structural index is built with
+// SIMD instructions first, then nodes are built from it. Accepts the same
+// documents as Load and gives the same result.
+// Large arrays at the top of the document, like base_requests, are split
+// between the given number of threads.
+Document LoadIndexed(std::string_view text, unsigned threads = 1);
+
 void Print(const Document& doc, std::ostream& output);
 
 }  // namespace json
\ No newline at end of file
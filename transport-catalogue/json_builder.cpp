@@ -1,5 +1,6 @@
 #include "json_builder.h"
 
+#include <charconv>
 #include <stdexcept>
 #include <iostream>
 
@@ -58,37 +59,20 @@ namespace json {
         return *this;
     }
     
-    Builder& Builder::Value(Node::Value value) {
-        Node new_value;
-        if(std::holds_alternative<Dict>(value)) {
-            new_value = std::get<Dict>(value);
-        } else if(std::holds_alternative<Array>(value)) {
-            new_value = std::get<Array>(value);
-        } else if(std::holds_alternative<std::string>(value)) {
-            new_value = std::get<std::string>(value);
-        } else if(std::holds_alternative<double>(value)) {
-            new_value = std::get<double>(value);
-        } else if(std::holds_alternative<int>(value)) {
-            new_value = std::get<int>(value);
-        } else if(std::holds_alternative<bool>(value)) {
-            new_value = std::get<bool>(value);
-        } else if(std::holds_alternative<std::nullptr_t>(value)) {
-            new_value = std::get<std::nullptr_t>(value);
-        } else {
-            throw std::logic_error("Value. Incorrect type for Value");
-        }
+    Builder& Builder::Value(Node value) {
+        Node new_value = std::move(value);
         
         if(!nodes_stack_.empty() && nodes_stack_.at(nodes_stack_.size() - 1)->IsMap() && has_key_ == true) {
             Node* last = nodes_stack_.at(nodes_stack_.size() - 1);
-            std::get<Dict>(last->GetValue())[key_] = new_value;
+            std::get<Dict>(last->GetValue())[key_] = std::move(new_value);
             key_.clear();
             has_key_ = false;
         } else if (!nodes_stack_.empty() && nodes_stack_.at(nodes_stack_.size() - 1)->IsArray()) {
             Node* last = nodes_stack_.at(nodes_stack_.size() - 1);
-            std::get<Array>(last->GetValue()).push_back(new_value);
+            std::get<Array>(last->GetValue()).push_back(std::move(new_value));
         } else if (nodes_stack_.empty() && !builder_was_created_) {
             builder_was_created_ = true;
-            root_ = Node(new_value);
+            root_ = std::move(new_value);
         } else {
             throw std::logic_error("Value. Incorrect type for Value");
         }
@@ -123,14 +107,281 @@ namespace json {
         return builder_.EndArray();
     }  
     
-    Builder::ArrayItemContext Builder::ArrayItemContext::Value(Node::Value value) {
-        return builder_.Value(value);
-        return ArrayItemContext(builder_);
+    Builder::ArrayItemContext Builder::ArrayItemContext::Value(Node value) {
+        return builder_.Value(std::move(value));
     }
     
-    Builder::ValueKeyItemContext Builder::KeyItemContext::Value(Node::Value value) {
-        builder_.Value(value);
+    Builder::ValueKeyItemContext Builder::KeyItemContext::Value(Node value) {
+        builder_.Value(std::move(value));
         return ValueKeyItemContext(builder_);
     }
     
+    namespace {
+        // The same layout json::Print uses: root items are indented by 2 spaces,
+        // every next level adds 4 more
+        const size_t INDENT = 2;
+        const size_t INDENT_STEP = 4;
+    }
+
+    StreamBuilder::StreamBuilder(std::string& output, Format format)
+        :output_(output)
+        ,format_(format)
+        {
+        }
+
+    void StreamBuilder::WriteIndent(size_t depth) {
+        if (format_ == Format::PRETTY) {
+            output_.append(INDENT + INDENT_STEP * depth, ' ');
+        }
+    }
+
+    void StreamBuilder::WriteLineBreak() {
+        if (format_ == Format::PRETTY) {
+            output_.push_back('\n');
+        }
+    }
+
+    void StreamBuilder::WriteString(std::string_view value) {
+        output_.push_back('"');
+        for (const char c : value) {
+            switch (c) {
+                case '\r':
+                    output_ += "\\r";
+                    break;
+                case '\n':
+                    output_ += "\\n";
+                    break;
+                case '"':
+                    [[fallthrough]];
+                case '\\':
+                    output_.push_back('\\');
+                    [[fallthrough]];
+                default:
+                    output_.push_back(c);
+                    break;
+            }
+        }
+        output_.push_back('"');
+    }
+
+    void StreamBuilder::StartValue(const char* method) {
+        if (levels_.empty()) {
+            if (builder_was_created_) {
+                throw std::logic_error(std::string(method) + ". Incorrect structure");
+            }
+            builder_was_created_ = true;
+        } else if (levels_.back().is_dict) {
+            if (!has_key_) {
+                throw std::logic_error(std::string(method) + ". Key not found");
+            }
+            has_key_ = false;
+        } else {
+            if (!levels_.back().is_empty) {
+                output_.push_back(',');
+                WriteLineBreak();
+            }
+            levels_.back().is_empty = false;
+            WriteIndent(levels_.size());
+        }
+    }
+
+    void StreamBuilder::StartContainer(bool is_dict, const char* method) {
+        StartValue(method);
+        output_.push_back(is_dict ? '{' : '[');
+        WriteLineBreak();
+        levels_.push_back({is_dict, true});
+    }
+
+    void StreamBuilder::EndContainer() {
+        const bool is_dict = levels_.back().is_dict;
+        levels_.pop_back();
+        WriteLineBreak();
+        WriteIndent(levels_.size());
+        output_.push_back(is_dict ? '}' : ']');
+    }
+
+    StreamBuilder::DictItemContext StreamBuilder::StartDict() {
+        StartContainer(true, "StartDict");
+        return *this;
+    }
+
+    StreamBuilder::KeyItemContext StreamBuilder::Key(std::string_view key) {
+        if (has_key_) {
+            throw std::logic_error("Key. Incorrect order for key");
+        }
+        if (levels_.empty() || !levels_.back().is_dict) {
+            throw std::logic_error("Key. Dictionary not found");
+        }
+        if (!levels_.back().is_empty) {
+            output_.push_back(',');
+            WriteLineBreak();
+        }
+        levels_.back().is_empty = false;
+        WriteIndent(levels_.size());
+        WriteString(key);
+        output_ += ": ";
+        has_key_ = true;
+        return *this;
+    }
+
+    StreamBuilder& StreamBuilder::EndDict() {
+        if (levels_.empty() || !levels_.back().is_dict || has_key_) {
+            throw std::logic_error("EndDict. Incorrect structure");
+        }
+        EndContainer();
+        return *this;
+    }
+
+    StreamBuilder::ArrayItemContext StreamBuilder::StartArray() {
+        StartContainer(false, "StartArray");
+        return *this;
+    }
+
+    StreamBuilder& StreamBuilder::EndArray() {
+        if (levels_.empty() || levels_.back().is_dict) {
+            throw std::logic_error("EndArray. Incorrect structure");
+        }
+        EndContainer();
+        return *this;
+    }
+
+    StreamBuilder& StreamBuilder::Value(std::nullptr_t) {
+        // json::Print writes null values this way
+        return Value("not found");
+    }
+
+    StreamBuilder& StreamBuilder::Value(bool value) {
+        StartValue("Value");
+        output_ += value ? "true" : "false";
+        return *this;
+    }
+
+    StreamBuilder& StreamBuilder::Value(int value) {
+        StartValue("Value");
+        char buffer[16];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        output_.append(buffer, result.ptr);
+        return *this;
+    }
+
+    StreamBuilder& StreamBuilder::Value(double value) {
+        StartValue("Value");
+        // Same as std::ostream with the default precision
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::general, 6);
+        output_.append(buffer, result.ptr);
+        return *this;
+    }
+
+    StreamBuilder& StreamBuilder::Value(std::string_view value) {
+        StartValue("Value");
+        WriteString(value);
+        return *this;
+    }
+
+    StreamBuilder& StreamBuilder::Value(const std::string& value) {
+        return Value(std::string_view(value));
+    }
+
+    StreamBuilder& StreamBuilder::Value(const char* value) {
+        return Value(std::string_view(value));
+    }
+
+    StreamBuilder& StreamBuilder::RawValue(std::string_view json) {
+        StartValue("RawValue");
+        output_ += json;
+        return *this;
+    }
+
+    StreamBuilder& StreamBuilder::RawValue(std::initializer_list<std::string_view> parts) {
+        StartValue("RawValue");
+        for (const std::string_view part : parts) {
+            output_ += part;
+        }
+        return *this;
+    }
+
+    StreamBuilder StreamBuilder::ForItems(std::string& output) const {
+        if (levels_.empty() || levels_.back().is_dict) {
+            throw std::logic_error("ForItems. Array not found");
+        }
+        StreamBuilder builder(output, format_);
+        builder.builder_was_created_ = true;
+        builder.levels_.assign(levels_.size(), Level{false, false});
+        return builder;
+    }
+
+    StreamBuilder& StreamBuilder::RawItems(std::string_view items) {
+        if (levels_.empty() || levels_.back().is_dict) {
+            throw std::logic_error("RawItems. Array not found");
+        }
+        if (items.empty()) {
+            return *this;
+        }
+        if (levels_.back().is_empty) {
+            // The first items of the array go without the separator
+            items.remove_prefix(format_ == Format::PRETTY ? 2 : 1);
+            levels_.back().is_empty = false;
+        }
+        output_ += items;
+        return *this;
+    }
+
+    std::string_view StreamBuilder::GetOutput() const {
+        return output_;
+    }
+
+    StreamBuilder& StreamBuilder::Value(const Node& node) {
+        if (node.IsMap()) {
+            StartDict();
+            for (const auto& [key, value] : node.AsMap()) {
+                Key(key);
+                Value(value);
+            }
+            EndDict();
+        } else if (node.IsArray()) {
+            StartArray();
+            for (const auto& value : node.AsArray()) {
+                Value(value);
+            }
+            EndArray();
+        } else {
+            std::visit([this](const auto& value) {
+                    using Type = std::decay_t<decltype(value)>;
+                    if constexpr (std::is_same_v<Type, String>) {
+                        Value(std::string_view(value));
+                    } else if constexpr (!std::is_same_v<Type, Dict> && !std::is_same_v<Type, Array>) {
+                        Value(value);
+                    }
+                }, node.GetValue());
+        }
+        return *this;
+    }
+
+    void StreamBuilder::Build() {
+        if (!levels_.empty() || !builder_was_created_) {
+            throw std::logic_error("Build");
+        }
+    }
+
+    StreamBuilder::KeyItemContext StreamBuilder::ItemContext::Key(std::string_view key) {
+        return builder_.Key(key);
+    }
+
+    StreamBuilder::DictItemContext StreamBuilder::ItemContext::StartDict() {
+        return builder_.StartDict();
+    }
+
+    StreamBuilder& StreamBuilder::ItemContext::EndDict() {
+        return builder_.EndDict();
+    }
+
+    StreamBuilder::ArrayItemContext StreamBuilder::ItemContext::StartArray() {
+        return builder_.StartArray();
+    }
+
+    StreamBuilder& StreamBuilder::ItemContext::EndArray() {
+        return builder_.EndArray();
+    }
+
 }  // namespace json
\ No newline at end of file
@@ -1,5 +1,12 @@
+#pragma once
+
 #include "json.h"
 
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
 namespace json {
     
     class Builder {
@@ -18,7 +25,7 @@ namespace json {
         Builder& EndDict();
         ArrayItemContext StartArray();
         Builder& EndArray();        
-        Builder& Value(Node::Value value);
+        Builder& Value(Node value);
         json::Node Build();
         
     private:
@@ -87,7 +94,7 @@ namespace json {
         using ItemContext::StartDict;
         using ItemContext::StartArray;
         
-        ValueKeyItemContext Value(Node::Value value);
+        ValueKeyItemContext Value(Node value);
         
     };
     
@@ -105,7 +112,153 @@ namespace json {
         using ItemContext::StartArray;
         using ItemContext::EndArray;
         
-        ArrayItemContext Value(Node::Value value);
+        ArrayItemContext Value(Node value);
     };
     
+    // Builder variant with the same call order checks which writes JSON text
+    // straight into the output buffer instead of building a Node tree.
+    // Text is formatted exactly like json::Print, dict keys are written
+    // in the order they are given.
+    class StreamBuilder {
+        class ItemContext;
+        class KeyItemContext;
+        class DictItemContext;
+        class ArrayItemContext;
+        class ValueKeyItemContext;
+
+    public:
+        enum class Format {
+            // The layout of json::Print
+            PRETTY,
+            // No line breaks, the whole value takes one line
+            LINE,
+        };
+
+        explicit StreamBuilder(std::string& output, Format format = Format::PRETTY);
+
+        DictItemContext StartDict();
+        KeyItemContext Key(std::string_view key);
+        StreamBuilder& EndDict();
+        ArrayItemContext StartArray();
+        StreamBuilder& EndArray();
+        StreamBuilder& Value(std::nullptr_t);
+        StreamBuilder& Value(bool value);
+        StreamBuilder& Value(int value);
+        StreamBuilder& Value(double value);
+        StreamBuilder& Value(std::string_view value);
+        StreamBuilder& Value(const std::string& value);
+        StreamBuilder& Value(const char* value);
+        StreamBuilder& Value(const Node& node);
+        // Writes a value already serialized to JSON as is, e.g. a string
+        // escaped once and put into many answers
+        StreamBuilder& RawValue(std::string_view json);
+        // One value made of the parts written one after another
+        StreamBuilder& RawValue(std::initializer_list<std::string_view> parts);
+        // Builder of a part of the items of the current array, they are put
+        // into it with RawItems. Every item is written after a separator, so
+        // parts may be written apart, e.g. on other threads, and joined later.
+        StreamBuilder ForItems(std::string& output) const;
+        // Appends the items written by a ForItems builder to the current array
+        StreamBuilder& RawItems(std::string_view items);
+        // All the text written to the output, e.g. to keep a value just written
+        std::string_view GetOutput() const;
+        void Build();
+
+    private:
+        struct Level {
+            bool is_dict = false;
+            bool is_empty = true;
+        };
+
+        std::string& output_;
+        Format format_;
+        std::vector<Level> levels_;
+        bool builder_was_created_ = false;
+        bool has_key_ = false;
+
+        void StartValue(const char* method);
+        void StartContainer(bool is_dict, const char* method);
+        void EndContainer();
+        void WriteIndent(size_t depth);
+        void WriteLineBreak();
+        void WriteString(std::string_view value);
+    };
+
+    class StreamBuilder::ItemContext {
+    public:
+        ItemContext(StreamBuilder& builder)
+            :builder_(builder)
+            {
+            }
+    protected:
+        DictItemContext StartDict();
+        KeyItemContext Key(std::string_view key);
+        StreamBuilder& EndDict();
+        ArrayItemContext StartArray();
+        StreamBuilder& EndArray();
+
+        StreamBuilder& builder_;
+    };
+
+    class StreamBuilder::ValueKeyItemContext : public ItemContext {
+    public:
+        using ItemContext::ItemContext;
+        using ItemContext::Key;
+        using ItemContext::EndDict;
+    };
+
+    class StreamBuilder::KeyItemContext : public ItemContext {
+    public:
+        using ItemContext::ItemContext;
+        using ItemContext::StartDict;
+        using ItemContext::StartArray;
+
+        template <typename Object>
+        ValueKeyItemContext Value(const Object& value) {
+            builder_.Value(value);
+            return ValueKeyItemContext(builder_);
+        }
+
+        ValueKeyItemContext RawValue(std::string_view json) {
+            builder_.RawValue(json);
+            return ValueKeyItemContext(builder_);
+        }
+
+        ValueKeyItemContext RawValue(std::initializer_list<std::string_view> parts) {
+            builder_.RawValue(parts);
+            return ValueKeyItemContext(builder_);
+        }
+    };
+
+    class StreamBuilder::DictItemContext : public ItemContext {
+    public:
+        using ItemContext::ItemContext;
+        using ItemContext::Key;
+        using ItemContext::EndDict;
+    };
+
+    class StreamBuilder::ArrayItemContext : public ItemContext {
+    public:
+        using ItemContext::ItemContext;
+        using ItemContext::StartDict;
+        using ItemContext::StartArray;
+        using ItemContext::EndArray;
+
+        template <typename Object>
+        ArrayItemContext Value(const Object& value) {
+            builder_.Value(value);
+            return ArrayItemContext(builder_);
+        }
+
+        ArrayItemContext RawValue(std::string_view json) {
+            builder_.RawValue(json);
+            return ArrayItemContext(builder_);
+        }
+
+        ArrayItemContext RawValue(std::initializer_list<std::string_view> parts) {
+            builder_.RawValue(parts);
+            return ArrayItemContext(builder_);
+        }
+    };
+
 }  // namespace json
\ No newline at end of file
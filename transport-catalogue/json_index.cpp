@@ -0,0 +1,249 @@
+#include "json_index.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JSON_INDEX_X86
+#include <immintrin.h>
+#endif
+
+namespace json {
+
+namespace {
+
+    const size_t BLOCK_SIZE = 64;
+
+    // Bit i of every mask stands for byte i of a 64-byte block
+    struct BlockMasks {
+        uint64_t backslash = 0;
+        uint64_t quote = 0;
+        uint64_t structural = 0;
+    };
+
+    uint64_t PrefixXor(uint64_t bits) {
+        bits ^= bits << 1;
+        bits ^= bits << 2;
+        bits ^= bits << 4;
+        bits ^= bits << 8;
+        bits ^= bits << 16;
+        bits ^= bits << 32;
+        return bits;
+    }
+
+    int CountTrailingZeros(uint64_t bits) {
+#if defined(__GNUC__)
+        return __builtin_ctzll(bits);
+#else
+        int result = 0;
+        while ((bits & 1) == 0) {
+            bits >>= 1;
+            ++result;
+        }
+        return result;
+#endif
+    }
+
+    // Keeps the state carried between blocks: whether the block starts
+    // with an escaped character and whether it starts inside a string
+    class BlockScanner {
+    public:
+        // Returns the bits of the block to put into the index
+        uint64_t Next(const BlockMasks& masks) {
+            const uint64_t quote = masks.quote & ~FindEscaped(masks.backslash);
+            const uint64_t in_string = PrefixXor(quote) ^ prev_in_string_;
+            prev_in_string_ = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+            return (masks.structural & ~in_string) | quote;
+        }
+
+    private:
+        // Characters preceded by an odd number of backslashes
+        uint64_t FindEscaped(uint64_t backslash) {
+            const uint64_t even_bits = 0x5555555555555555ULL;
+            backslash &= ~prev_escaped_;
+            const uint64_t follows_escape = backslash << 1 | prev_escaped_;
+            const uint64_t odd_sequence_starts = backslash & ~even_bits & ~follows_escape;
+            const uint64_t sequences_starting_on_even_bits = odd_sequence_starts + backslash;
+            prev_escaped_ = sequences_starting_on_even_bits < odd_sequence_starts ? 1 : 0;
+            const uint64_t invert_mask = sequences_starting_on_even_bits << 1;
+            return (even_bits ^ invert_mask) & follows_escape;
+        }
+
+        uint64_t prev_escaped_ = 0;
+        uint64_t prev_in_string_ = 0;
+    };
+
+    BlockMasks ClassifyScalar(const char* block) {
+        BlockMasks masks;
+        for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+            const uint64_t bit = uint64_t(1) << i;
+            switch (block[i]) {
+                case '\\':
+                    masks.backslash |= bit;
+                    break;
+                case '"':
+                    masks.quote |= bit;
+                    break;
+                case '{':
+                case '}':
+                case '[':
+                case ']':
+                case ':':
+                case ',':
+                    masks.structural |= bit;
+                    break;
+                default:
+                    break;
+            }
+        }
+        return masks;
+    }
+
+    template <typename Classify>
+#if defined(__GNUC__)
+    __attribute__((always_inline))
+#endif
+    inline void ScanBlocks(std::string_view text, StructuralIndex& index, Classify classify) {
+        BlockScanner scanner;
+        auto add_bits = [&index](size_t offset, uint64_t bits) {
+            while (bits != 0) {
+                index.push_back(offset + CountTrailingZeros(bits));
+                bits &= bits - 1;
+            }
+        };
+
+        size_t offset = 0;
+        for (; offset + BLOCK_SIZE <= text.size(); offset += BLOCK_SIZE) {
+            add_bits(offset, scanner.Next(classify(text.data() + offset)));
+        }
+        if (offset < text.size()) {
+            // The tail is padded with spaces, they never get into the index
+            char block[BLOCK_SIZE];
+            std::memset(block, ' ', BLOCK_SIZE);
+            std::memcpy(block, text.data() + offset, text.size() - offset);
+            add_bits(offset, scanner.Next(classify(block)));
+        }
+    }
+
+    void BuildIndexScalar(std::string_view text, StructuralIndex& index) {
+        ScanBlocks(text, index, ClassifyScalar);
+    }
+
+#ifdef JSON_INDEX_X86
+    // i386 builds have no SSE2 by default, it is checked at run time
+    __attribute__((target("sse2"), always_inline))
+    inline BlockMasks ClassifySse2(const char* block) {
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i open_brace = _mm_set1_epi8('{');
+        const __m128i close_brace = _mm_set1_epi8('}');
+        const __m128i open_bracket = _mm_set1_epi8('[');
+        const __m128i close_bracket = _mm_set1_epi8(']');
+        const __m128i colon = _mm_set1_epi8(':');
+        const __m128i comma = _mm_set1_epi8(',');
+
+        BlockMasks masks;
+        for (size_t i = 0; i < BLOCK_SIZE; i += 16) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+            const __m128i structural = _mm_or_si128(
+                _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, open_brace), _mm_cmpeq_epi8(chunk, close_brace)),
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, open_bracket), _mm_cmpeq_epi8(chunk, close_bracket))),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, colon), _mm_cmpeq_epi8(chunk, comma)));
+            masks.backslash |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, backslash)))) << i;
+            masks.quote |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote)))) << i;
+            masks.structural |= uint64_t(uint16_t(_mm_movemask_epi8(structural))) << i;
+        }
+        return masks;
+    }
+
+    __attribute__((target("avx2"), always_inline))
+    inline BlockMasks ClassifyAvx2(const char* block) {
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i open_brace = _mm256_set1_epi8('{');
+        const __m256i close_brace = _mm256_set1_epi8('}');
+        const __m256i open_bracket = _mm256_set1_epi8('[');
+        const __m256i close_bracket = _mm256_set1_epi8(']');
+        const __m256i colon = _mm256_set1_epi8(':');
+        const __m256i comma = _mm256_set1_epi8(',');
+
+        BlockMasks masks;
+        for (size_t i = 0; i < BLOCK_SIZE; i += 32) {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+            const __m256i structural = _mm256_or_si256(
+                _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(chunk, open_brace), _mm256_cmpeq_epi8(chunk, close_brace)),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(chunk, open_bracket), _mm256_cmpeq_epi8(chunk, close_bracket))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, colon), _mm256_cmpeq_epi8(chunk, comma)));
+            masks.backslash |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, backslash)))) << i;
+            masks.quote |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, quote)))) << i;
+            masks.structural |= uint64_t(uint32_t(_mm256_movemask_epi8(structural))) << i;
+        }
+        return masks;
+    }
+
+    struct Sse2Classifier {
+        __attribute__((target("sse2")))
+        BlockMasks operator()(const char* block) const {
+            return ClassifySse2(block);
+        }
+    };
+
+    struct Avx2Classifier {
+        __attribute__((target("avx2")))
+        BlockMasks operator()(const char* block) const {
+            return ClassifyAvx2(block);
+        }
+    };
+
+    __attribute__((target("sse2")))
+    void BuildIndexSse2(std::string_view text, StructuralIndex& index) {
+        ScanBlocks(text, index, Sse2Classifier{});
+    }
+
+    // Everything is inlined here, so the whole loop is built for AVX2
+    __attribute__((target("avx2")))
+    void BuildIndexAvx2(std::string_view text, StructuralIndex& index) {
+        ScanBlocks(text, index, Avx2Classifier{});
+    }
+#endif
+
+}  // namespace
+
+    IndexBackend GetBestIndexBackend() {
+#ifdef JSON_INDEX_X86
+        static const IndexBackend backend = __builtin_cpu_supports("avx2") ? IndexBackend::AVX2
+            : __builtin_cpu_supports("sse2") ? IndexBackend::SSE2
+            : IndexBackend::SCALAR;
+        return backend;
+#else
+        return IndexBackend::SCALAR;
+#endif
+    }
+
+    StructuralIndex BuildStructuralIndex(std::string_view text) {
+        return BuildStructuralIndex(text, GetBestIndexBackend());
+    }
+
+    StructuralIndex BuildStructuralIndex(std::string_view text, IndexBackend backend) {
+        StructuralIndex index;
+        // About one structural character per 8 bytes in base_requests
+        index.reserve(text.size() / 8);
+        switch (backend) {
+#ifdef JSON_INDEX_X86
+            case IndexBackend::AVX2:
+                BuildIndexAvx2(text, index);
+                break;
+            case IndexBackend::SSE2:
+                BuildIndexSse2(text, index);
+                break;
+#endif
+            default:
+                BuildIndexScalar(text, index);
+                break;
+        }
+        return index;
+    }
+
+}  // namespace json
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace json {
+
+    // Stage one of the two-stage parser. Positions of the quotes which open
+    // and close strings and of the structural characters { } [ ] : , found
+    // outside strings, in text order. If the text ends inside a string, the
+    // last quote has no pair.
+    using StructuralIndex = std::vector<size_t>;
+
+    enum class IndexBackend {
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+
+    // The widest instruction set available on this CPU
+    IndexBackend GetBestIndexBackend();
+
+    // Classifies the text in 64-byte blocks
+    StructuralIndex BuildStructuralIndex(std::string_view text);
+    // The backend must be supported by the CPU, see GetBestIndexBackend
+    StructuralIndex BuildStructuralIndex(std::string_view text, IndexBackend backend);
+
+}  // namespace json
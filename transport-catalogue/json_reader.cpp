@@ -1,68 +1,164 @@
 #include "json_reader.h"
 #include "json_builder.h"
 
+#include <fstream>
 #include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define JSON_READER_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std; 
 using namespace json;
 
 namespace json_reader {
 
+namespace {
+
+    // Read-only view of a whole file. Where mmap is not available the file
+    // is read into memory.
+    class MappedFile {
+    public:
+        explicit MappedFile(const string& path) {
+#ifdef JSON_READER_MMAP
+            const int fd = open(path.c_str(), O_RDONLY);
+            if (fd == -1) {
+                throw runtime_error("Cannot open "s + path);
+            }
+            struct stat info;
+            if (fstat(fd, &info) == -1) {
+                close(fd);
+                throw runtime_error("Cannot read "s + path);
+            }
+            size_ = static_cast<size_t>(info.st_size);
+            if (size_ > 0) {
+                void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED) {
+                    close(fd);
+                    throw runtime_error("Cannot map "s + path);
+                }
+                data_ = static_cast<const char*>(data);
+                // The text is read once from the beginning to the end
+                madvise(data, size_, MADV_SEQUENTIAL);
+            }
+            close(fd);
+#else
+            ifstream file(path, ios::binary);
+            if (!file) {
+                throw runtime_error("Cannot open "s + path);
+            }
+            ostringstream content;
+            content << file.rdbuf();
+            buffer_ = content.str();
+            data_ = buffer_.data();
+            size_ = buffer_.size();
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile() {
+#ifdef JSON_READER_MMAP
+            if (data_ != nullptr) {
+                munmap(const_cast<char*>(data_), size_);
+            }
+#endif
+        }
+
+        string_view GetText() const {
+            return {data_, size_};
+        }
+
+    private:
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+#ifndef JSON_READER_MMAP
+        string buffer_;
+#endif
+    };
+
+    unsigned GetParsingThreads() {
+        return max(1u, thread::hardware_concurrency());
+    }
+
+}  // namespace
+
+    // From this size on the input is parsed by the two-stage parser
+    const size_t INDEXED_PARSING_MIN_SIZE = 1 << 20;
+
     Document LoadJSON(const string& s) {
+        if (s.size() >= INDEXED_PARSING_MIN_SIZE) {
+            return LoadIndexed(s, GetParsingThreads());
+        }
         std::istringstream strm(s);
         return Load(strm);
     }
 
+    Document ReadJSON(istream& input) {
+        string text;
+        string line;
+        while (getline(input, line) && line != "exit"sv) {
+            text += line;
+        }
+        return LoadJSON(text);
+    }
+
+    Document LoadJSONFile(const string& path) {
+        // Nodes copy their strings, so the file is not needed after parsing
+        const MappedFile file(path);
+        return LoadIndexed(file.GetText(), GetParsingThreads());
+    }
+
     std::string Print(const Node& node) {
         std::ostringstream out;
         Print(json::Document{ node }, out);
         return out.str();
     }
 
-    Dict GetStopInfo(int id, const string& name, catalogue::TransportCatalogue& new_catalogue){
-        auto result = json::Builder{};
-        result.StartDict().Key("request_id"s).Value(id);
-        vector<string> buses = new_catalogue.FindBus(name);
-        if (buses.at(0) == "not found"s) {
-			result.Key("error_message"s).Value("not found"s);
-		}
-		else if (buses.at(0) == "no buses"s) {
-			Array no_buses = {};
-			result.Key("buses"s).Value(no_buses);
-		} else {
-			Array buses_info;
-			for (const auto& bus : buses) {
-				buses_info.push_back(json::Node(bus));
-			}
-			result.Key("buses"s).Value(buses_info);
-		}
-        
-        return result.EndDict().Build().AsMap();
+    // Keys are written in alphabetical order, the same way json::Print outputs a Dict
+    void GetStopInfo(json::StreamBuilder& answer, int id, string_view name, const catalogue::TransportCatalogue& new_catalogue){
+        const auto buses = new_catalogue.GetBusesForStop(name);
+        if (buses == nullptr) {
+            answer.StartDict().Key("error_message"sv).Value("not found"sv)
+                .Key("request_id"sv).Value(id).EndDict();
+            return;
+        }
+        auto buses_info = answer.StartDict().Key("buses"sv).StartArray();
+        for (const auto bus : *buses) {
+            buses_info.Value(bus);
+        }
+        buses_info.EndArray().Key("request_id"sv).Value(id).EndDict();
     }
     
-    Dict GetBusInfo(int id, const string& name, catalogue::TransportCatalogue& new_catalogue) {
-        auto result = json::Builder{};
-        result.StartDict().Key("request_id"s).Value(id);
+    void GetBusInfo(json::StreamBuilder& answer, int id, string_view name, const catalogue::TransportCatalogue& new_catalogue) {
         catalogue::TransportCatalogue::BusInfo bus_info = new_catalogue.GetBusInfo(name);
-		if (!bus_info.existence) {
-			result.Key("error_message"s).Value("not found"s);
-		}
-		else {
-			result.Key("curvature"s).Value(bus_info.curvature);
-			result.Key("route_length"s).Value(static_cast<double>(bus_info.length));
-			result.Key("stop_count"s).Value(bus_info.stops_on_route);
-			result.Key("unique_stop_count"s).Value(bus_info.unique_stops);
-		}
-        
-        return result.EndDict().Build().AsMap();
+        if (!bus_info.existence) {
+            answer.StartDict().Key("error_message"sv).Value("not found"sv)
+                .Key("request_id"sv).Value(id).EndDict();
+            return;
+        }
+        answer.StartDict()
+            .Key("curvature"sv).Value(bus_info.curvature)
+            .Key("request_id"sv).Value(id)
+            .Key("route_length"sv).Value(static_cast<double>(bus_info.length))
+            .Key("stop_count"sv).Value(bus_info.stops_on_route)
+            .Key("unique_stop_count"sv).Value(bus_info.unique_stops)
+            .EndDict();
     }
 
-	Dict GetAnswer(int id, const string& type, const std::string& name, catalogue::TransportCatalogue& new_catalogue) {
-        if(type == "Stop") {
-            return GetStopInfo(id, name, new_catalogue);
+    void GetAnswer(json::StreamBuilder& answer, int id, string_view type, string_view name, const catalogue::TransportCatalogue& new_catalogue) {
+        if(type == "Stop"sv) {
+            GetStopInfo(answer, id, name, new_catalogue);
         } else {
-            return GetBusInfo(id, name, new_catalogue);
+            GetBusInfo(answer, id, name, new_catalogue);
         }
-	}
+    }
 
 }  // namespace json_reader
\ No newline at end of file
@@ -1,18 +1,26 @@
 #pragma once
 
 #include "json.h"
+#include "json_builder.h"
 #include "transport_catalogue.h"
 
+#include <istream>
 #include <string>
+#include <string_view>
 
 namespace json_reader {
 
     json::Document LoadJSON(const std::string& s);
+    // Reads lines up to the one saying "exit"
+    json::Document ReadJSON(std::istream& input);
+    // Maps the file into memory and parses it in place, large arrays like
+    // base_requests are parsed on all the cores
+    json::Document LoadJSONFile(const std::string& path);
     std::string Print(const json::Node& node);
 
-    using Dict = std::map<std::string, json::Node>;
-    using Array = std::vector<json::Node>;
-    Dict GetBusInfo(int id, const std::string& name, catalogue::TransportCatalogue& new_catalogue); 
-    Dict GetBusInfo(int id, const std::string& name, catalogue::TransportCatalogue& new_catalogue); 
-    Dict GetAnswer(int id, const std::string& type, const std::string& name, catalogue::TransportCatalogue& new_catalogue);
-}  // namespace json_reader
\ No newline at end of file
+    using Dict = json::Dict;
+    using Array = json::Array;
+    void GetStopInfo(json::StreamBuilder& answer, int id, std::string_view name, const catalogue::TransportCatalogue& new_catalogue);
+    void GetBusInfo(json::StreamBuilder& answer, int id, std::string_view name, const catalogue::TransportCatalogue& new_catalogue);
+    void GetAnswer(json::StreamBuilder& answer, int id, std::string_view type, std::string_view name, const catalogue::TransportCatalogue& new_catalogue);
+}  // namespace json_reader
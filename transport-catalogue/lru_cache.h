@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lru_cache {
+
+    struct CacheStats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+
+    // Cache of values shared by many threads, the least recently used ones
+    // are dropped to keep it within the memory budget. Keys are spread over
+    // shards, each with its own lock, so threads seldom wait for each other.
+    // Values are kept by shared pointers and stay valid after eviction.
+    template <typename Key, typename Value, typename Hash = std::hash<Key>>
+    class LruCache {
+    public:
+        // Bytes taken by an entry besides the ones given to Insert
+        static constexpr size_t ENTRY_OVERHEAD = sizeof(Key) + 8 * sizeof(void*);
+
+        explicit LruCache(size_t budget_bytes, size_t shard_count = 16);
+
+        // Nothing if the key is not cached, the entry becomes the most recent
+        std::shared_ptr<const Value> Find(const Key& key);
+        // bytes is the memory taken by the value. A value larger than the
+        // budget of a shard is not kept.
+        void Insert(Key key, std::shared_ptr<const Value> value, size_t bytes);
+        CacheStats GetStats() const;
+
+    private:
+        struct Entry {
+            Key key;
+            std::shared_ptr<const Value> value;
+            size_t bytes;
+        };
+
+        struct Shard {
+            std::mutex mutex;
+            // The most recent entries first
+            std::list<Entry> entries;
+            std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> index;
+            size_t bytes = 0;
+        };
+
+        Shard& GetShard(const Key& key);
+
+        std::vector<std::unique_ptr<Shard>> shards_;
+        size_t shard_budget_;
+        Hash hash_;
+        std::atomic<size_t> hits_ = 0;
+        std::atomic<size_t> misses_ = 0;
+        std::atomic<size_t> evictions_ = 0;
+    };
+
+    template <typename Key, typename Value, typename Hash>
+    LruCache<Key, Value, Hash>::LruCache(size_t budget_bytes, size_t shard_count)
+        : shard_budget_(budget_bytes / std::max<size_t>(shard_count, 1)) {
+        for (size_t i = 0; i < std::max<size_t>(shard_count, 1); ++i) {
+            shards_.push_back(std::make_unique<Shard>());
+        }
+    }
+
+    template <typename Key, typename Value, typename Hash>
+    typename LruCache<Key, Value, Hash>::Shard& LruCache<Key, Value, Hash>::GetShard(const Key& key) {
+        // The low bits pick the bucket inside the shard, the high ones the shard
+        const size_t hash = hash_(key);
+        return *shards_[(hash ^ (hash >> 29)) % shards_.size()];
+    }
+
+    template <typename Key, typename Value, typename Hash>
+    std::shared_ptr<const Value> LruCache<Key, Value, Hash>::Find(const Key& key) {
+        Shard& shard = GetShard(key);
+        std::lock_guard guard(shard.mutex);
+        const auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            ++misses_;
+            return nullptr;
+        }
+        ++hits_;
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return it->second->value;
+    }
+
+    template <typename Key, typename Value, typename Hash>
+    void LruCache<Key, Value, Hash>::Insert(Key key, std::shared_ptr<const Value> value, size_t bytes) {
+        bytes += ENTRY_OVERHEAD;
+        if (bytes > shard_budget_) {
+            return;
+        }
+        Shard& shard = GetShard(key);
+        std::lock_guard guard(shard.mutex);
+        if (const auto it = shard.index.find(key); it != shard.index.end()) {
+            // Another thread has put it meanwhile
+            return;
+        }
+        while (shard.bytes + bytes > shard_budget_) {
+            const Entry& oldest = shard.entries.back();
+            shard.bytes -= oldest.bytes;
+            shard.index.erase(oldest.key);
+            shard.entries.pop_back();
+            ++evictions_;
+        }
+        shard.entries.push_front(Entry{key, std::move(value), bytes});
+        shard.index.emplace(std::move(key), shard.entries.begin());
+        shard.bytes += bytes;
+    }
+
+    template <typename Key, typename Value, typename Hash>
+    CacheStats LruCache<Key, Value, Hash>::GetStats() const {
+        CacheStats stats;
+        stats.hits = hits_;
+        stats.misses = misses_;
+        stats.evictions = evictions_;
+        for (const auto& shard : shards_) {
+            std::lock_guard guard(shard->mutex);
+            stats.entries += shard->entries.size();
+            stats.bytes += shard->bytes;
+        }
+        return stats;
+    }
+
+}  // namespace lru_cache
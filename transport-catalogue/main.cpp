@@ -1,9 +1,20 @@
 #include "svg.h"
 #include "json.h"
+#include "json_builder.h"
 #include "transport_catalogue.h"
 #include "map_renderer.h"
 #include "json_reader.h"
 #include "transport_router.h"
+#include "request_handler.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <optional>
 
 using namespace std::literals;
 using namespace json;
@@ -11,42 +22,102 @@ using namespace json_reader;
 using namespace svg;
 using namespace map_render;
 
-int main() {
-    std::string input_info;
-    json::Node node;
-    catalogue::TransportCatalogue catalogue;
-
-    // Read data from ctdin
-    while (true) {
-        std::string str;
-        if (!getline(std::cin, str) || (str == "exit"sv)) {
-            node = LoadJSON(input_info).GetRoot();
-            break;
+int main(int argc, char* argv[]) {
+    // Requests are read from stdin, or from the file given with --input.
+    // Rendered maps are kept in the directory given with --map-cache.
+    // With --serve the program keeps running after the stat requests and
+    // answers lines of requests from stdin, see server::AnswerLine. With
+    // --socket or --port it answers the clients of a Unix domain socket or
+    // of a loopback TCP port instead, on --workers threads, until SIGINT or
+    // SIGTERM. Repeated requests are answered from a memo of --memo MiB, 0
+    // turns it off.
+    // The routes found are kept in a cache of --route-cache MiB, it is off
+    // by default: the router looks up any route in its table quickly.
+    // With --stats the time of the phases and their counters are printed to
+    // stderr at the end, a Stats request gets them at any time. They and the
+    // latencies of requests are recorded with --stats or after a Stats
+    // request, gauges such as sizes always. With --trace the phases and
+    // the requests are written to the file given at the end as a timeline
+    // for chrome://tracing or Perfetto.
+    std::string input_path;
+    std::string map_cache_path;
+    server::SocketSettings socket_settings;
+    bool serve = false;
+    bool print_stats = false;
+    std::string trace_path;
+    size_t memo_budget = 64 << 20;
+    size_t route_cache_budget = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i] == "--input"sv && i + 1 < argc) {
+            input_path = argv[++i];
+        } else if (argv[i] == "--map-cache"sv && i + 1 < argc) {
+            map_cache_path = argv[++i];
+        } else if (argv[i] == "--serve"sv) {
+            serve = true;
+        } else if (argv[i] == "--socket"sv && i + 1 < argc) {
+            socket_settings.path = argv[++i];
+            serve = true;
+        } else if (argv[i] == "--port"sv && i + 1 < argc) {
+            socket_settings.port = std::atoi(argv[++i]);
+            serve = true;
+        } else if (argv[i] == "--workers"sv && i + 1 < argc) {
+            socket_settings.workers = std::max(1, std::atoi(argv[++i]));
+        } else if (argv[i] == "--memo"sv && i + 1 < argc) {
+            memo_budget = static_cast<size_t>(std::max(0, std::atoi(argv[++i]))) << 20;
+        } else if (argv[i] == "--route-cache"sv && i + 1 < argc) {
+            route_cache_budget = static_cast<size_t>(std::max(0, std::atoi(argv[++i]))) << 20;
+        } else if (argv[i] == "--stats"sv) {
+            print_stats = true;
+        } else if (argv[i] == "--trace"sv && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else {
+            std::cerr << "Usage: "sv << argv[0] << " [--input <file>] [--map-cache <directory>] [--serve]"sv
+                      << " [--socket <path> | --port <port>] [--workers <count>]"sv
+                      << " [--memo <MiB>] [--route-cache <MiB>] [--stats]"sv
+                      << " [--trace <file>]"sv << std::endl;
+            return 1;
         }
-        input_info += str;
     }
 
+    if (print_stats) {
+        stats::Enable();
+    }
+    if (!trace_path.empty()) {
+        trace::Start();
+    }
+
+    catalogue::TransportCatalogue catalogue;
+
+    // The document owns the memory of all its nodes, keep it until the end
+    const json::Document document = [&input_path] {
+        stats::ScopedTimer timer("parse"sv);
+        return input_path.empty() ? ReadJSON(std::cin) : LoadJSONFile(input_path);
+    }();
+    const json::Node& node = document.GetRoot();
+
     // put Stops in a catalogue
-    for (auto data : node.AsMap().at("base_requests").AsArray()) {
+    std::optional<stats::ScopedTimer> timer(std::in_place, "catalogue.stops"sv);
+    for (const auto& data : node.AsMap().at("base_requests").AsArray()) {
         if (data.AsMap().at("type").AsString() == "Stop") {
-            std::string name = data.AsMap().at("name").AsString();
+            std::string name(data.AsMap().at("name").AsString());
             geo::Coordinates coord = { data.AsMap().at("latitude").AsDouble(), data.AsMap().at("longitude").AsDouble() };
             std::vector<std::pair<std::string, double>> road_distances;
-            for (const auto [name, distance] : data.AsMap().at("road_distances").AsMap()) {
-                road_distances.push_back({ name, distance.AsDouble() });
+            for (const auto& [name, distance] : data.AsMap().at("road_distances").AsMap()) {
+                road_distances.push_back({ std::string(name), distance.AsDouble() });
             }
             catalogue.AddStop(name, coord, road_distances);
         }
     }
 
     // put Buses in a catalogue
+    timer.emplace("catalogue.buses"sv);
     MapRender map_render;
-    for (auto data : node.AsMap().at("base_requests").AsArray()) {
+    for (const auto& data : node.AsMap().at("base_requests").AsArray()) {
         if (data.AsMap().at("type").AsString() == "Bus") {
-            std::string name = data.AsMap().at("name").AsString();
+            std::string name(data.AsMap().at("name").AsString());
             std::vector<std::string> stops;
             for (const auto& stop : data.AsMap().at("stops").AsArray()) {
-                stops.push_back(stop.AsString());
+                stops.emplace_back(stop.AsString());
             }
             bool is_roundtrip = data.AsMap().at("is_roundtrip").AsBool();
             catalogue.AddBus(name);
@@ -55,49 +126,123 @@ int main() {
             map_render.AddBus(name);  // Fill data for map_render
         }
     }
+    timer.reset();
+    stats::SetGauge("catalogue.stops"sv, catalogue.GetStopsIndex().size());
+    stats::SetGauge("catalogue.buses"sv, catalogue.GetBusesIndex().size());
     
-    auto bus_settings = node.AsMap().at("routing_settings").AsMap();
+    // A server may be started without stat requests
+    static const json::Array no_requests;
+    const auto& stat_requests = serve && !node.AsMap().count("stat_requests")
+        ? no_requests : node.AsMap().at("stat_requests").AsArray();
+
+    // The map is only rendered for Map and RouteMap requests. When there are
+    // any, it is rendered along with building the router. A server renders
+    // it in advance for the requests to come.
+    LazyMap map(catalogue, FillRenderSettings(node.AsMap().at("render_settings").AsMap()), map_render);
+    map.SetCacheDirectory(map_cache_path);
+    const bool has_map_requests = request_handler::HasMapRequests(stat_requests);
+    if (has_map_requests || serve) {
+        map.RenderAsync();
+    }
+
+    const auto& bus_settings = node.AsMap().at("routing_settings").AsMap();
     int bus_velocity = bus_settings.at("bus_velocity").AsInt();
     double bus_wait_time = bus_settings.at("bus_wait_time").AsDouble();
     
+    // The router is built on another thread while the requests before the
+    // first Route one are answered and written. Without Route requests it
+    // is not built at all, unless a server gets them later.
     router::TransportRouter transport_router(catalogue);
     transport_router.SetSettings(bus_velocity, bus_wait_time);
-    transport_router.MakeGraph();
-    graph::Router<double> new_router(transport_router.GetGraph());
-
-    // Fill a map
-    RenderSettings render_settings;
-    render_settings = FillRenderSettings(node.AsMap().at("render_settings").AsMap());
-
-    std::string new_data = FillSvgDocument(catalogue, render_settings, map_render);
-    json::Node doc_new = json::Node(new_data);
-
+    if (route_cache_budget > 0) {
+        transport_router.EnableRouteCache(route_cache_budget);
+    }
+    std::unique_ptr<graph::Router<double>> new_router;
+    const request_handler::RouterFuture router_future = std::async(
+        request_handler::HasRouteRequests(stat_requests) || serve ? std::launch::async : std::launch::deferred,
+        [&transport_router, &new_router]() -> const graph::Router<double>* {
+            transport_router.MakeGraph();
+            {
+                stats::ScopedTimer timer("router.precompute"sv);
+                new_router = std::make_unique<graph::Router<double>>(transport_router.GetGraph());
+            }
+            stats::SetGauge("router.table_bytes"sv, new_router->GetTableBytes());
+            return new_router.get();
+        }).share();
+    request_handler::RequestHandler handler(catalogue, map, transport_router, router_future);
+    if (memo_budget > 0) {
+        handler.EnableMemo(memo_budget);
+    }
+    const auto write_trace = [&trace_path] {
+        if (trace_path.empty()) {
+            return;
+        }
+        std::ofstream output(trace_path, std::ios::binary);
+        trace::Write(output);
+        if (!output) {
+            std::cerr << "Cannot write the trace to "sv << trace_path << std::endl;
+        }
+    };
+    const auto print_memo_stats = [&handler, &transport_router] {
+        const auto print = [](std::string_view name, const lru_cache::CacheStats& stats) {
+            if (const size_t lookups = stats.hits + stats.misses; lookups > 0) {
+                std::cerr << name << ": "sv << stats.hits << " hits of "sv << lookups << " lookups ("sv
+                          << 100. * stats.hits / lookups << "%), "sv << stats.evictions << " evicted, "sv
+                          << stats.entries << " kept in "sv << stats.bytes << " bytes"sv << std::endl;
+            }
+        };
+        print("Answers memo"sv, handler.GetMemoStats());
+        print("Route cache"sv, transport_router.GetRouteCacheStats());
+    };
 
-    // Return info by stdout
-    
-    std::vector<json::Node> answer;
-    for (auto data : node.AsMap().at("stat_requests").AsArray()) {
-        int id = data.AsMap().at("id").AsInt();
-        std::string type = data.AsMap().at("type").AsString();
-        if (type == "Stop" || type == "Bus") {
-            std::string name = data.AsMap().at("name").AsString();
-            answer.push_back(GetAnswer(id, type, name, catalogue));
+    if (serve) {
+        std::string output;
+        if (!stat_requests.empty()) {
+            server::AnswerRequests(handler, stat_requests, output);
+            std::cout << output << std::flush;
         }
-        else if (type == "Map") {
-            std::map<std::string, json::Node> cur_answer;
-            cur_answer["map"] = doc_new;
-            cur_answer["request_id"] = id;
-            answer.push_back(cur_answer);
+        if (socket_settings.path.empty() && socket_settings.port == 0) {
+            server::ServeStream(handler, std::cin, std::cout);
+        } else {
+            server::ServeSockets(handler, socket_settings);
         }
-        else if (type =="Route") {
-            std::string from = data.AsMap().at("from").AsString();
-            std::string to = data.AsMap().at("to").AsString();
-            answer.push_back(transport_router.GetGraphData(from, to, id, new_router));
-            
+        print_memo_stats();
+        if (print_stats) {
+            stats::Print(stats::GetSnapshot(), std::cerr);
         }
-        continue;
+        write_trace();
+        return 0;
     }
 
-    std::cout << Print(answer);
+    // Return info by stdout
+    
+    const size_t flush_size = 1 << 16;
+    std::string output;
+    output.reserve(2 * flush_size);
+    json::StreamBuilder answer(output);
+    answer.StartArray();
+    handler.AnswerAll(stat_requests, answer, [&output, flush_size, &router_future] {
+        // The answers are not held back while the router is being built
+        if (output.size() >= flush_size
+            || router_future.wait_for(std::chrono::seconds(0)) == std::future_status::timeout) {
+            stats::ScopedTimer timer("output"sv);
+            stats::AddCount("output.bytes"sv, static_cast<int64_t>(output.size()));
+            std::cout << output << std::flush;
+            output.clear();
+        }
+    });
+    answer.EndArray().Build();
+
+    print_memo_stats();
+
+    stats::AddCount("output.bytes"sv, static_cast<int64_t>(output.size()));
+    {
+        stats::ScopedTimer timer("output"sv);
+        std::cout << output << std::flush;
+    }
+    if (print_stats) {
+        stats::Print(stats::GetSnapshot(), std::cerr);
+    }
+    write_trace();
 
 }
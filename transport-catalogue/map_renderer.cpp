@@ -1,6 +1,18 @@
 #include "map_renderer.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "trace.h"
 
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <unordered_map>
 
 using namespace std;
 
@@ -10,13 +22,13 @@ namespace map_render {
         buses_.insert(bus);
     }
 
-    std::set<std::string> MapRender::GetBuses() const {
+    const std::set<std::string>& MapRender::GetBuses() const {
         return buses_;
     }
 
     svg::Color FillCollor(const json::Node& color) {
         if (color.IsString()) {
-            return color.AsString();
+            return std::string(color.AsString());
         }
         else if (color.IsArray()) {
             if (color.AsArray().size() == 3) {
@@ -57,14 +69,14 @@ namespace map_render {
                 result.bus_label_font_size = settings.at("bus_label_font_size").AsInt();
             }
             if (settings.count("bus_label_offset")) {
-                json::Array tmp_offset = settings.at("bus_label_offset").AsArray();
+                const json::Array& tmp_offset = settings.at("bus_label_offset").AsArray();
                 result.bus_label_offset = { tmp_offset[0].AsDouble(), tmp_offset[1].AsDouble() };
             }
             if (settings.count("stop_label_font_size")) {
                 result.stop_label_font_size = settings.at("stop_label_font_size").AsInt();
             }
             if (settings.count("stop_label_offset")) {
-                json::Array tmp_offset = settings.at("stop_label_offset").AsArray();
+                const json::Array& tmp_offset = settings.at("stop_label_offset").AsArray();
                 result.stop_label_offset = { tmp_offset[0].AsDouble(), tmp_offset[1].AsDouble() };
             }
             if (settings.count("underlayer_color")) {
@@ -74,224 +86,999 @@ namespace map_render {
                 result.underlayer_width = settings.at("underlayer_width").AsDouble();
             }
             if (settings.count("color_palette")) {
-                for (auto color : settings.at("color_palette").AsArray()) {
+                for (const auto& color : settings.at("color_palette").AsArray()) {
                     result.color_palete.push_back(FillCollor(color));
                 }
             }
+            if (settings.count("simplify_tolerance")) {
+                result.simplify_tolerance = settings.at("simplify_tolerance").AsDouble();
+            }
+            if (settings.count("label_placement")) {
+                result.label_placement = settings.at("label_placement").AsBool();
+            }
             return result;
         }
 
     
     
-    vector<svg::Polyline> DrawRoute(const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render) {
-        vector<svg::Polyline> polylines;
-        auto coordinates = catalogue_new.GetCoordinates();
+    namespace {
+
+        bool IsSamePoint(svg::Point lhs, svg::Point rhs) {
+            return lhs.x == rhs.x && lhs.y == rhs.y;
+        }
+
+        double GetDistanceToSegment(svg::Point point, svg::Point from, svg::Point to) {
+            const double dx = to.x - from.x;
+            const double dy = to.y - from.y;
+            const double length2 = dx * dx + dy * dy;
+            double t = 0.;
+            if (length2 > 0.) {
+                t = std::clamp(((point.x - from.x) * dx + (point.y - from.y) * dy) / length2, 0., 1.);
+            }
+            return std::hypot(point.x - (from.x + t * dx), point.y - (from.y + t * dy));
+        }
+
+        // Douglas-Peucker over the projected route points. Repeated points are
+        // dropped first. The line of a route which turns back starts and ends
+        // at the same point, then the farthest point is kept first.
+        std::vector<size_t> SimplifyLine(const std::vector<svg::Point>& points, const std::vector<size_t>& stops, double tolerance) {
+            std::vector<size_t> line;
+            line.reserve(stops.size());
+            for (size_t stop : stops) {
+                if (line.empty() || !IsSamePoint(points[line.back()], points[stop])) {
+                    line.push_back(stop);
+                }
+            }
+            if (line.size() <= 2) {
+                return line;
+            }
+
+            std::vector<bool> keep(line.size(), false);
+            keep.front() = keep.back() = true;
+            std::vector<std::pair<size_t, size_t>> ranges{{0, line.size() - 1}};
+            while (!ranges.empty()) {
+                const auto [first, last] = ranges.back();
+                ranges.pop_back();
+                double max_distance = 0.;
+                size_t farthest = first;
+                for (size_t i = first + 1; i < last; ++i) {
+                    const double distance = GetDistanceToSegment(points[line[i]], points[line[first]], points[line[last]]);
+                    if (distance > max_distance) {
+                        max_distance = distance;
+                        farthest = i;
+                    }
+                }
+                if (max_distance > tolerance) {
+                    keep[farthest] = true;
+                    ranges.push_back({first, farthest});
+                    ranges.push_back({farthest, last});
+                }
+            }
+
+            std::vector<size_t> result;
+            for (size_t i = 0; i < line.size(); ++i) {
+                if (keep[i]) {
+                    result.push_back(line[i]);
+                }
+            }
+            return result;
+        }
+
+        // Text extents are not known without the font. The spatial index
+        // gives titles boxes large enough for the widest glyphs, so no title
+        // is left out of a viewport it reaches into. Label placement takes
+        // the average width of Verdana glyphs instead: with the widest ones
+        // many titles would be hidden for overlaps they do not have.
+        const double TITLE_CHAR_WIDTH = 1.;
+        const double TITLE_PLACEMENT_CHAR_WIDTH = 0.6;
+        const double TITLE_DESCENT = 0.3;
+
+        size_t CountCodePoints(std::string_view text) {
+            return std::count_if(text.begin(), text.end(), [](char c) {
+                return (static_cast<unsigned char>(c) & 0xC0) != 0x80;
+            });
+        }
+
+        // The box of a title drawn at the position with the offset, the underlayer included
+        BoundingBox GetTitleBox(svg::Point position, svg::Point offset, int font_size, std::string_view text, double underlayer_width,
+                                double char_width = TITLE_CHAR_WIDTH) {
+            const double x = position.x + offset.x;
+            const double y = position.y + offset.y;
+            const double width = font_size * char_width * CountCodePoints(text);
+            const double margin = underlayer_width / 2;
+            return {x - margin, y - font_size - margin, x + width + margin, y + font_size * TITLE_DESCENT + margin};
+        }
+
+        // The final stop of a route which turns back, it gets a title too
+        std::optional<size_t> GetFinalStop(const MapLayout::Route& route) {
+            const size_t final_stop = route.stops.at(route.stops.size() / 2);
+            if (route.is_roundtrip || final_stop == route.stops.front()) {
+                return std::nullopt;
+            }
+            return final_stop;
+        }
+
+        // Spatial hash of the titles placed so far. Cells are about the size
+        // of a title, so a box is checked against a few titles near it only.
+        class TitleGrid {
+        public:
+            explicit TitleGrid(double cell_size)
+                : cell_size_(cell_size) {
+            }
+
+            // Titles which only touch do not overlap
+            bool Overlaps(const BoundingBox& box) const {
+                bool result = false;
+                ForEachCell(box, [this, &box, &result](uint64_t cell) {
+                    const auto it = cells_.find(cell);
+                    if (result || it == cells_.end()) {
+                        return;
+                    }
+                    result = std::any_of(it->second.begin(), it->second.end(), [this, &box](uint32_t i) {
+                        const BoundingBox& other = boxes_[i];
+                        return box.min_x < other.max_x && other.min_x < box.max_x
+                            && box.min_y < other.max_y && other.min_y < box.max_y;
+                    });
+                });
+                return result;
+            }
+
+            void Add(const BoundingBox& box) {
+                const auto index = static_cast<uint32_t>(boxes_.size());
+                boxes_.push_back(box);
+                ForEachCell(box, [this, index](uint64_t cell) {
+                    cells_[cell].push_back(index);
+                });
+            }
+
+        private:
+            template <typename Func>
+            void ForEachCell(const BoundingBox& box, Func func) const {
+                const auto first_column = GetCell(box.min_x);
+                const auto last_column = GetCell(box.max_x);
+                for (auto row = GetCell(box.min_y), last_row = GetCell(box.max_y); row <= last_row; ++row) {
+                    for (auto column = first_column; column <= last_column; ++column) {
+                        func(static_cast<uint64_t>(static_cast<uint32_t>(row)) << 32 | static_cast<uint32_t>(column));
+                    }
+                }
+            }
+
+            int32_t GetCell(double coordinate) const {
+                return static_cast<int32_t>(std::floor(coordinate / cell_size_));
+            }
+
+            double cell_size_;
+            std::vector<BoundingBox> boxes_;
+            std::unordered_map<uint64_t, std::vector<uint32_t>> cells_;
+        };
+
+        // Titles are placed greedily: route titles first, then the titles of
+        // the stops with more routes. Each one takes the first place which
+        // does not overlap the titles placed before: the offset from the
+        // settings, then the offset mirrored to the left, upwards and both.
+        // A title which fits nowhere is hidden.
+        void PlaceTitles(MapLayout& layout, const RenderSettings& render_settings) {
+            const int max_font_size = std::max({render_settings.bus_label_font_size, render_settings.stop_label_font_size, 1});
+            TitleGrid grid(4. * max_font_size + render_settings.underlayer_width);
+
+            auto place = [&](svg::Point point, svg::Point offset, int font_size, std::string_view text) {
+                const BoundingBox box = GetTitleBox(point, offset, font_size, text, render_settings.underlayer_width,
+                                                    TITLE_PLACEMENT_CHAR_WIDTH);
+                const double shift_x = -2 * offset.x - (box.max_x - box.min_x - render_settings.underlayer_width);
+                const double shift_y = font_size * (1 - TITLE_DESCENT) - 2 * offset.y;
+                const svg::Point shifts[] = {{0., 0.}, {shift_x, 0.}, {0., shift_y}, {shift_x, shift_y}};
+                for (const svg::Point shift : shifts) {
+                    const BoundingBox moved{box.min_x + shift.x, box.min_y + shift.y, box.max_x + shift.x, box.max_y + shift.y};
+                    if (!grid.Overlaps(moved)) {
+                        grid.Add(moved);
+                        if (shift.x != 0. || shift.y != 0.) {
+                            ++layout.moved_title_count;
+                        }
+                        return MapLayout::Title{{point.x + shift.x, point.y + shift.y}, false};
+                    }
+                }
+                ++layout.hidden_title_count;
+                return MapLayout::Title{point, true};
+            };
+
+            layout.route_titles.resize(layout.routes.size());
+            for (size_t number = 0; number < layout.routes.size(); ++number) {
+                const auto& route = layout.routes[number];
+                auto& titles = layout.route_titles[number];
+                titles[0] = place(layout.points[route.stops.front()], render_settings.bus_label_offset,
+                                  render_settings.bus_label_font_size, route.bus);
+                if (const auto final_stop = GetFinalStop(route)) {
+                    titles[1] = place(layout.points[*final_stop], render_settings.bus_label_offset,
+                                      render_settings.bus_label_font_size, route.bus);
+                }
+            }
+
+            std::vector<size_t> route_counts(layout.points.size(), 0);
+            for (const auto& route : layout.routes) {
+                for (size_t stop : route.stops) {
+                    ++route_counts[stop];
+                }
+            }
+            std::vector<size_t> stops = layout.stops_by_name;
+            std::stable_sort(stops.begin(), stops.end(), [&route_counts](size_t lhs, size_t rhs) {
+                return route_counts[lhs] > route_counts[rhs];
+            });
+            layout.stop_titles.resize(layout.points.size());
+            for (size_t stop : stops) {
+                layout.stop_titles[stop] = place(layout.points[stop], render_settings.stop_label_offset,
+                                                 render_settings.stop_label_font_size, layout.stop_names[stop]);
+            }
+        }
+
+    }  // namespace
+
+    MapLayout MakeMapLayout(const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render) {
+        using Stop = catalogue::TransportCatalogue::Stop;
+        MapLayout layout;
+        const auto& buses_index = catalogue_new.GetBusesIndex();
+
+        // Number the stops on the routes in the order they are met
+        std::unordered_map<const Stop*, size_t> stop_ids;
+        std::vector<geo::Coordinates> coordinates;
+        for (const auto& bus : map_render.GetBuses()) {
+            const auto it = buses_index.find(bus);
+            if (it == buses_index.end() || it->second->stops.empty()) {
+                continue;
+            }
+            const auto& bus_data = *it->second;
+            MapLayout::Route route{bus_data.name, bus_data.is_roundtrip, {}, {}};
+            route.stops.reserve(bus_data.stops.size());
+            for (const Stop* stop : bus_data.stops) {
+                const auto [id, inserted] = stop_ids.emplace(stop, coordinates.size());
+                if (inserted) {
+                    coordinates.push_back(stop->coord);
+                    layout.stop_names.push_back(stop->name);
+                }
+                route.stops.push_back(id->second);
+            }
+            layout.routes.push_back(std::move(route));
+        }
+
+        // The bounding box of the unique stops is the same as of all the route points
         const SphereProjector proj{ coordinates.begin(),
                                    coordinates.end(),
                                    render_settings.width,
                                    render_settings.height,
                                    render_settings.padding };
-        int number = 0;
+        layout.points.reserve(coordinates.size());
+        for (const auto& coord : coordinates) {
+            layout.points.push_back(proj(coord));
+        }
 
-        // Draw buses
-        for (auto bus : map_render.GetBuses()) {
-            auto size_palete = render_settings.color_palete.size();
-            int i = number % size_palete;
-            svg::Polyline polyline;
-            polyline.SetStrokeLineCap(svg::StrokeLineCap::ROUND);
-            polyline.SetStrokeWidth(render_settings.line_width);
-            polyline.SetStrokeLineJoin(svg::StrokeLineJoin::ROUND);
-            polyline.SetFillColor("none");
-            polyline.SetStrokeColor(render_settings.color_palete.at(i));
-            if (catalogue_new.GetBusStops(bus).size() == 0) {
-                continue;
-            }
-            for (auto stop : catalogue_new.GetBusStops(bus)) {
-                svg::Point new_point = proj(stop->coord);
-                polyline.AddPoint(new_point);
+        for (auto& route : layout.routes) {
+            if (render_settings.simplify_tolerance > 0.) {
+                route.line = SimplifyLine(layout.points, route.stops, render_settings.simplify_tolerance);
+            } else {
+                route.line = route.stops;
             }
-            polylines.push_back(std::move(polyline));
-            ++number;
+            layout.route_stop_count += route.stops.size();
+            layout.line_vertex_count += route.line.size();
         }
-        return polylines;
+        stats::SetGauge("map.route_stops"sv, layout.route_stop_count);
+        stats::SetGauge("map.line_vertexes"sv, layout.line_vertex_count);
+
+        layout.stops_by_name.resize(coordinates.size());
+        std::iota(layout.stops_by_name.begin(), layout.stops_by_name.end(), 0);
+        std::sort(layout.stops_by_name.begin(), layout.stops_by_name.end(), [&layout](size_t lhs, size_t rhs) {
+            return layout.stop_names[lhs] < layout.stop_names[rhs];
+        });
+
+        if (render_settings.label_placement) {
+            PlaceTitles(layout, render_settings);
+            stats::SetGauge("map.moved_titles"sv, layout.moved_title_count);
+            stats::SetGauge("map.hidden_titles"sv, layout.hidden_title_count);
+        }
+        return layout;
     }
-    
-    std::pair<svg::Text, svg::Text> FillTextForRoutes(const RenderSettings& render_settings, svg::Point& new_point, const string& bus, int color_index) {
-        std::pair<svg::Text, svg::Text> text;
-        svg::Text background_text;
-        background_text.SetPosition(new_point)
-            .SetOffset(render_settings.bus_label_offset)
-            .SetFontSize(render_settings.bus_label_font_size)
-            .SetFontFamily("Verdana"s)
-            .SetFontWeight("bold")
-            .SetData(bus)
-            .SetFillColor(render_settings.underlayer_color)
+
+    MapStyles MakeMapStyles(const RenderSettings& render_settings, const svg::Writer& writer) {
+        MapStyles styles;
+        for (const auto& color : render_settings.color_palete) {
+            svg::Style line;
+            line.SetStrokeLineCap(svg::StrokeLineCap::ROUND)
+                .SetStrokeWidth(render_settings.line_width)
+                .SetStrokeLineJoin(svg::StrokeLineJoin::ROUND)
+                .SetFillColor("none")
+                .SetStrokeColor(color);
+            styles.route_lines.push_back(writer.Escape(line.Render()));
+            styles.route_titles.push_back(writer.Escape(svg::Style().SetFillColor(color).Render()));
+        }
+
+        svg::Style underlayer;
+        underlayer.SetFillColor(render_settings.underlayer_color)
             .SetStrokeColor(render_settings.underlayer_color)
             .SetStrokeWidth(render_settings.underlayer_width)
             .SetStrokeLineCap(svg::StrokeLineCap::ROUND)
             .SetStrokeLineJoin(svg::StrokeLineJoin::ROUND);
+        styles.route_title_underlayer = writer.Escape(underlayer.Render());
+        styles.stop_title_underlayer = styles.route_title_underlayer;
+
+        styles.route_title_font = writer.Escape(svg::Writer::RenderTextFont(render_settings.bus_label_offset,
+            render_settings.bus_label_font_size, "Verdana"sv, "bold"sv));
+        styles.stop_title_font = writer.Escape(svg::Writer::RenderTextFont(render_settings.stop_label_offset,
+            render_settings.stop_label_font_size, "Verdana"sv, {}));
+
+        styles.stop_circle = writer.Escape(svg::Style().SetFillColor("white").Render());
+        styles.stop_radius = render_settings.stop_radius;
+        styles.stop_title = writer.Escape(svg::Style().SetFillColor("black").Render());
 
-        svg::Text title_text;
-        title_text.SetPosition(new_point)
-            .SetOffset(render_settings.bus_label_offset)
-            .SetFontSize(render_settings.bus_label_font_size)
-            .SetFontFamily("Verdana"s)
-            .SetFontWeight("bold")
-            .SetData(bus)
-            .SetFillColor(render_settings.color_palete.at(color_index));
-        return {background_text, title_text};
+        for (const auto& color : render_settings.color_palete) {
+            svg::Style line;
+            line.SetStrokeLineCap(svg::StrokeLineCap::ROUND)
+                .SetStrokeWidth(2 * render_settings.line_width)
+                .SetStrokeLineJoin(svg::StrokeLineJoin::ROUND)
+                .SetFillColor("none")
+                .SetStrokeColor(color);
+            styles.journey_lines.push_back(writer.Escape(line.Render()));
+        }
+        svg::Style journey_underlayer;
+        journey_underlayer.SetStrokeLineCap(svg::StrokeLineCap::ROUND)
+            .SetStrokeWidth(2 * render_settings.line_width + render_settings.underlayer_width)
+            .SetStrokeLineJoin(svg::StrokeLineJoin::ROUND)
+            .SetFillColor("none")
+            .SetStrokeColor(render_settings.underlayer_color);
+        styles.journey_underlayer = writer.Escape(journey_underlayer.Render());
+        return styles;
     }
-    
-    vector<svg::Text> DrawTitlesForRoutes (const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render) {
-        vector<svg::Text> texts;
-        auto coordinates = catalogue_new.GetCoordinates();
-        const SphereProjector proj{ coordinates.begin(),
-                                   coordinates.end(),
-                                   render_settings.width,
-                                   render_settings.height,
-                                   render_settings.padding };
-        int number = 0;
-        
-        for (auto bus : map_render.GetBuses()) {
-            auto size_palete = render_settings.color_palete.size();
-            int i = number % size_palete;
 
-            if (catalogue_new.GetBusStops(bus).size() == 0) {
-                continue;
+    void DrawRoute(const MapLayout& layout, const MapStyles& styles, size_t first, size_t last, svg::Writer& writer) {
+        const auto size_palete = styles.route_lines.size();
+
+        // Draw buses
+        for (size_t number = first; number < last; ++number) {
+            writer.StartPolyline();
+            for (size_t stop : layout.routes[number].line) {
+                writer.AddPolylinePoint(layout.points[stop]);
             }
-            
-            int last = catalogue_new.GetBusStops(bus).size() / 2;
-            if (catalogue_new.BusWithRoundtrip(bus) ||
-                catalogue_new.GetBusStops(bus).at(last)->name == catalogue_new.GetBusStops(bus).at(0)->name) {
-                
-                geo::Coordinates coord = catalogue_new.GetBusStops(bus).at(0)->coord;
-                svg::Point new_point = proj(coord);
-                auto text = FillTextForRoutes(render_settings, new_point, bus, i);
-                
-                texts.push_back(std::move(text.first));
-                texts.push_back(std::move(text.second));
-            }
-            else {
-                // for the first stop
-                svg::Text background_text_1;
-                geo::Coordinates coord = catalogue_new.GetBusStops(bus).at(0)->coord;
-                svg::Point new_point = proj(coord);
-                auto text_first = FillTextForRoutes(render_settings, new_point, bus, i);
-                
-                // for the second stop
-                geo::Coordinates coord_2 = catalogue_new.GetBusStops(bus).at(last)->coord;
-                svg::Point new_point_2 = proj(coord_2);
-                auto text_second = FillTextForRoutes(render_settings, new_point_2, bus, i);
-
-                texts.push_back(std::move(text_first.first));
-                texts.push_back(std::move(text_first.second));
-                texts.push_back(std::move(text_second.first));
-                texts.push_back(std::move(text_second.second));
-            }
-            ++number;
-        }
-        return texts;
+            writer.EndPolyline(styles.route_lines.at(number % size_palete));
+        }
     }
     
-    vector<svg::Circle> DrawCirlesForStops (const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, std::set<std::string>& unique_stops) {
-        vector<svg::Circle> circles;
-        auto coordinates = catalogue_new.GetCoordinates();
-        const SphereProjector proj{ coordinates.begin(),
-                                   coordinates.end(),
-                                   render_settings.width,
-                                   render_settings.height,
-                                   render_settings.padding };
-        
-        for (auto stop : unique_stops) {
-            svg::Circle circle;
-            geo::Coordinates coord = catalogue_new.GetStop(stop)->coord;
-            svg::Point new_point = proj(coord);
-
-            circle.SetCenter(new_point);
-            circle.SetRadius(render_settings.stop_radius);
-            circle.SetFillColor("white");
+    void DrawRouteTitle(const MapLayout& layout, const MapStyles& styles, size_t route, size_t part, svg::Writer& writer) {
+        svg::Point position = layout.points[part == 0 ? layout.routes[route].stops.front() : *GetFinalStop(layout.routes[route])];
+        if (!layout.route_titles.empty()) {
+            const MapLayout::Title& placed = layout.route_titles[route][part];
+            if (placed.hidden) {
+                return;
+            }
+            position = placed.position;
+        }
+        const std::string& title = styles.route_titles.at(route % styles.route_titles.size());
+        const std::string_view bus = layout.routes[route].bus;
+        writer.WriteText(position, bus, styles.route_title_underlayer, styles.route_title_font);
+        writer.WriteText(position, bus, title, styles.route_title_font);
+    }
 
-            circles.push_back(std::move(circle));
+    void DrawTitlesForRoutes (const MapLayout& layout, const MapStyles& styles, size_t first, size_t last, svg::Writer& writer) {
+        for (size_t number = first; number < last; ++number) {
+            DrawRouteTitle(layout, styles, number, 0, writer);
+            if (GetFinalStop(layout.routes[number])) {
+                DrawRouteTitle(layout, styles, number, 1, writer);
+            }
         }
-        return circles;
     }
     
-    std::pair<svg::Text, svg::Text> FillTextForStops(const RenderSettings& render_settings, svg::Point& new_point, const string& stop) {
-        std::pair<svg::Text, svg::Text> text;
-        
-        svg::Text background_text;
-        background_text.SetPosition(new_point)
-            .SetOffset(render_settings.stop_label_offset)
-            .SetFontSize(render_settings.stop_label_font_size)
-            .SetFontFamily("Verdana")
-            .SetData(stop)
-            .SetFillColor(render_settings.underlayer_color)
-            .SetStrokeColor(render_settings.underlayer_color)
-            .SetStrokeWidth(render_settings.underlayer_width)
-            .SetStrokeLineCap(svg::StrokeLineCap::ROUND)
-            .SetStrokeLineJoin(svg::StrokeLineJoin::ROUND);
-        
-        svg::Text title_text;
-        title_text.SetPosition(new_point)
-            .SetOffset(render_settings.stop_label_offset)
-            .SetFontSize(render_settings.stop_label_font_size)
-            .SetFontFamily("Verdana")
-            .SetData(stop)
-            .SetFillColor("black");
-        return {background_text, title_text};
+    void DrawCirlesForStops (const MapLayout& layout, const MapStyles& styles, size_t first, size_t last, svg::Writer& writer) {
+        for (size_t i = first; i < last; ++i) {
+            const size_t stop = layout.stops_by_name[i];
+            writer.WriteCircle(layout.points[stop], styles.stop_radius, styles.stop_circle);
+        }
     }
         
-    vector<svg::Text> DrawTitlesForStops (const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, std::set<std::string>& unique_stops) {
-        vector<svg::Text> texts;
-        auto coordinates = catalogue_new.GetCoordinates();
-        const SphereProjector proj{ coordinates.begin(),
-                                   coordinates.end(),
-                                   render_settings.width,
-                                   render_settings.height,
-                                   render_settings.padding };
-        for (auto stop : unique_stops) {
-            geo::Coordinates coord = catalogue_new.GetStop(stop)->coord;
-            svg::Point new_point = proj(coord);
-            std::pair<svg::Text, svg::Text> text = FillTextForStops(render_settings, new_point, stop);
-            texts.push_back(std::move(text.first));
-            texts.push_back(std::move(text.second));
+    void DrawTitlesForStops (const MapLayout& layout, const MapStyles& styles, size_t first, size_t last, svg::Writer& writer) {
+        for (size_t i = first; i < last; ++i) {
+            const size_t stop = layout.stops_by_name[i];
+            svg::Point position = layout.points[stop];
+            if (!layout.stop_titles.empty()) {
+                if (layout.stop_titles[stop].hidden) {
+                    continue;
+                }
+                position = layout.stop_titles[stop].position;
+            }
+            writer.WriteText(position, layout.stop_names[stop], styles.stop_title_underlayer, styles.stop_title_font);
+            writer.WriteText(position, layout.stop_names[stop], styles.stop_title, styles.stop_title_font);
         }
-        return texts;
     }
     
+    namespace {
+
+        std::optional<size_t> FindStop(const MapLayout& layout, std::string_view name) {
+            const auto it = std::lower_bound(layout.stops_by_name.begin(), layout.stops_by_name.end(), name,
+                                             [&layout](size_t stop, std::string_view name) {
+                return layout.stop_names[stop] < name;
+            });
+            if (it == layout.stops_by_name.end() || layout.stop_names[*it] != name) {
+                return std::nullopt;
+            }
+            return *it;
+        }
+
+        std::optional<size_t> FindRoute(const MapLayout& layout, std::string_view bus) {
+            const auto it = std::lower_bound(layout.routes.begin(), layout.routes.end(), bus,
+                                             [](const MapLayout::Route& route, std::string_view bus) {
+                return route.bus < bus;
+            });
+            if (it == layout.routes.end() || it->bus != bus) {
+                return std::nullopt;
+            }
+            return it - layout.routes.begin();
+        }
+
+        // Part of a route ridden without changing buses: route.stops[first, last]
+        struct Ride {
+            size_t route;
+            size_t first;
+            size_t last;
+        };
+
+        // The router goes along one half of a route which turns back, as the
+        // buses do, so the ride is looked for within one half
+        std::optional<Ride> FindRide(const MapLayout& layout, size_t number, size_t from, size_t to, size_t span_count) {
+            const auto& stops = layout.routes[number].stops;
+            const size_t half = layout.routes[number].is_roundtrip ? stops.size() - 1 : stops.size() / 2;
+            const std::pair<size_t, size_t> parts[] = {{0, half}, {half, stops.size() - 1}};
+            for (const auto& [begin, end] : parts) {
+                for (size_t i = begin; i + span_count <= end; ++i) {
+                    if (stops[i] == from && stops[i + span_count] == to) {
+                        return Ride{number, i, i + span_count};
+                    }
+                }
+            }
+            return std::nullopt;
+        }
+
+        // Routes or stops drawn by one task. Smaller pieces do not pay off
+        // the cost of a task and of one more buffer.
+        const size_t ROUTES_PER_PIECE = 256;
+        const size_t STOPS_PER_PIECE = 1024;
+
+        using DrawLayer = void (*)(const MapLayout&, const MapStyles&, size_t, size_t, svg::Writer&);
+
+        struct MapPiece {
+            // The layer, for the trace
+            std::string_view name;
+            DrawLayer draw;
+            size_t first;
+            size_t last;
+        };
+
+        void AddPieces(std::vector<MapPiece>& pieces, std::string_view name, DrawLayer draw, size_t count,
+                       size_t piece_size) {
+            for (size_t first = 0; first < count; first += piece_size) {
+                pieces.push_back({name, draw, first, std::min(count, first + piece_size)});
+            }
+        }
+
+    }  // namespace
+
+    void DrawJourney(const MapLayout& layout, const MapStyles& styles, const json::Array& items, std::string_view to, svg::Writer& writer) {
+        // Items go in pairs: waiting at a stop and riding a bus from it
+        std::vector<Ride> rides;
+        for (size_t i = 1; i < items.size(); i += 2) {
+            const json::Dict& ride = items[i].AsMap();
+            const std::string_view next = i + 1 < items.size() ? items[i + 1].AsMap().at("stop_name").AsString() : to;
+            const auto number = FindRoute(layout, ride.at("bus").AsString());
+            const auto from_stop = FindStop(layout, items[i - 1].AsMap().at("stop_name").AsString());
+            const auto to_stop = FindStop(layout, next);
+            if (number && from_stop && to_stop) {
+                if (const auto found = FindRide(layout, *number, *from_stop, *to_stop, ride.at("span_count").AsInt())) {
+                    rides.push_back(*found);
+                }
+            }
+        }
+
+        auto draw_line = [&layout, &writer](const Ride& ride, std::string_view style) {
+            writer.StartPolyline();
+            for (size_t i = ride.first; i <= ride.last; ++i) {
+                writer.AddPolylinePoint(layout.points[layout.routes[ride.route].stops[i]]);
+            }
+            writer.EndPolyline(style);
+        };
+        for (const Ride& ride : rides) {
+            draw_line(ride, styles.journey_underlayer);
+        }
+        for (const Ride& ride : rides) {
+            draw_line(ride, styles.journey_lines.at(ride.route % styles.journey_lines.size()));
+        }
+
+        // Stops where rides begin and end, or the only stop of an empty journey
+        std::vector<size_t> ends;
+        for (const Ride& ride : rides) {
+            const auto& stops = layout.routes[ride.route].stops;
+            // A change stays at the stop where the previous ride ends
+            const bool is_change = !ends.empty() && ends.back() == stops[ride.first];
+            for (size_t i = is_change ? ride.first + 1 : ride.first; i <= ride.last; ++i) {
+                writer.WriteCircle(layout.points[stops[i]], styles.stop_radius, styles.stop_circle);
+            }
+            if (!is_change) {
+                ends.push_back(stops[ride.first]);
+            }
+            ends.push_back(stops[ride.last]);
+        }
+        if (rides.empty()) {
+            if (const auto stop = FindStop(layout, to)) {
+                writer.WriteCircle(layout.points[*stop], styles.stop_radius, styles.stop_circle);
+                ends.push_back(*stop);
+            }
+        }
+
+        for (const Ride& ride : rides) {
+            const svg::Point position = layout.points[layout.routes[ride.route].stops[ride.first]];
+            const std::string_view bus = layout.routes[ride.route].bus;
+            writer.WriteText(position, bus, styles.route_title_underlayer, styles.route_title_font);
+            writer.WriteText(position, bus, styles.route_titles.at(ride.route % styles.route_titles.size()), styles.route_title_font);
+        }
+        for (size_t stop : ends) {
+            writer.WriteText(layout.points[stop], layout.stop_names[stop], styles.stop_title_underlayer, styles.stop_title_font);
+            writer.WriteText(layout.points[stop], layout.stop_names[stop], styles.stop_title, styles.stop_title_font);
+        }
+    }
+
+    void DrawMap(const MapLayout& layout, const MapStyles& styles, svg::Writer::Escaping escaping, std::string& output) {
+        svg::Writer writer(output, escaping);
+
+        // The order of the pieces is the order of the layers on the map
+        std::vector<MapPiece> pieces;
+        AddPieces(pieces, "map.routes"sv, DrawRoute, layout.routes.size(), ROUTES_PER_PIECE);
+        AddPieces(pieces, "map.route_titles"sv, DrawTitlesForRoutes, layout.routes.size(), ROUTES_PER_PIECE);
+        AddPieces(pieces, "map.stop_circles"sv, DrawCirlesForStops, layout.stops_by_name.size(), STOPS_PER_PIECE);
+        AddPieces(pieces, "map.stop_titles"sv, DrawTitlesForStops, layout.stops_by_name.size(), STOPS_PER_PIECE);
+
+        std::vector<std::string> buffers(pieces.size());
+        thread_pool::GetDefaultPool().ParallelFor(pieces.size(), [&](size_t i) {
+            trace::Span span(pieces[i].name);
+            svg::Writer piece_writer(buffers[i], escaping);
+            pieces[i].draw(layout, styles, pieces[i].first, pieces[i].last, piece_writer);
+        });
+
+        size_t size = output.size();
+        for (const auto& buffer : buffers) {
+            size += buffer.size();
+        }
+        output.reserve(size + 64);
+
+        writer.StartDocument();
+        for (const auto& buffer : buffers) {
+            output += buffer;
+        }
+        writer.EndDocument();
+    }
+
     std::string FillSvgDocument(const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render) {
-        
-        svg::Document doc;
-        for(auto polyline : DrawRoute(catalogue_new, render_settings, map_render)){
-            doc.Add(polyline);
+        std::string result;
+        const svg::Writer writer(result);
+        DrawMap(MakeMapLayout(catalogue_new, render_settings, map_render), MakeMapStyles(render_settings, writer),
+                svg::Writer::Escaping::NONE, result);
+        return result;
+    }
+
+    std::string FillSvgJsonString(const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render) {
+        std::string result = "\""s;
+        const svg::Writer writer(result, svg::Writer::Escaping::JSON);
+        DrawMap(MakeMapLayout(catalogue_new, render_settings, map_render), MakeMapStyles(render_settings, writer),
+                svg::Writer::Escaping::JSON, result);
+        result += '"';
+        return result;
+    }
+
+    BoundingBox GetTileBox(const RenderSettings& render_settings, int z, int x, int y) {
+        const double tile_width = std::ldexp(render_settings.width, -z);
+        const double tile_height = std::ldexp(render_settings.height, -z);
+        return {x * tile_width, y * tile_height, (x + 1) * tile_width, (y + 1) * tile_height};
+    }
+
+    std::optional<BoundingBox> FillViewport(const json::Dict& request, const RenderSettings& render_settings) {
+        if (request.count("bbox")) {
+            const json::Array& bbox = request.at("bbox").AsArray();
+            return BoundingBox{bbox.at(0).AsDouble(), bbox.at(1).AsDouble(), bbox.at(2).AsDouble(), bbox.at(3).AsDouble()};
+        }
+        if (request.count("tile")) {
+            const json::Dict& tile = request.at("tile").AsMap();
+            return GetTileBox(render_settings, tile.at("z").AsInt(), tile.at("x").AsInt(), tile.at("y").AsInt());
         }
+        return std::nullopt;
+    }
+
+    namespace {
 
-        for(auto text : DrawTitlesForRoutes(catalogue_new, render_settings, map_render)){
-            doc.Add(text);
+        // Items in a grid cell on average
+        const size_t ITEMS_PER_CELL = 8;
+        const size_t MAX_GRID_SIDE = 2048;
+
+        BoundingBox MakeBox(svg::Point point, double margin) {
+            return {point.x - margin, point.y - margin, point.x + margin, point.y + margin};
         }
 
-        std::set<std::string> unique_stops;
-        for (auto bus : map_render.GetBuses()) {
-            if (catalogue_new.GetBusStops(bus).size() == 0) {
+    }  // namespace
+
+    MapIndex::MapIndex(const MapLayout& layout, const RenderSettings& render_settings) {
+        using Layer = MapIndex::Layer;
+        const double line_margin = render_settings.line_width / 2;
+
+        for (size_t number = 0; number < layout.routes.size(); ++number) {
+            const auto& route = layout.routes[number];
+            const Element element{Layer::ROUTES, static_cast<uint32_t>(number), 0};
+            items_.push_back({MakeBox(layout.points[route.line.front()], line_margin), element});
+            for (size_t i = 1; i < route.line.size(); ++i) {
+                const svg::Point from = layout.points[route.line[i - 1]];
+                const svg::Point to = layout.points[route.line[i]];
+                items_.push_back({{std::min(from.x, to.x) - line_margin, std::min(from.y, to.y) - line_margin,
+                                   std::max(from.x, to.x) + line_margin, std::max(from.y, to.y) + line_margin},
+                                  element});
+            }
+
+            const std::optional<size_t> final_stop = GetFinalStop(route);
+            const size_t title_stops[] = {route.stops.front(), final_stop.value_or(route.stops.front())};
+            for (size_t part = 0; part < (final_stop ? 2 : 1); ++part) {
+                svg::Point position = layout.points[title_stops[part]];
+                if (!layout.route_titles.empty()) {
+                    if (layout.route_titles[number][part].hidden) {
+                        continue;
+                    }
+                    position = layout.route_titles[number][part].position;
+                }
+                items_.push_back({GetTitleBox(position, render_settings.bus_label_offset, render_settings.bus_label_font_size,
+                                              route.bus, render_settings.underlayer_width),
+                                  {Layer::ROUTE_TITLES, static_cast<uint32_t>(number), static_cast<uint8_t>(part)}});
+            }
+        }
+
+        for (size_t i = 0; i < layout.stops_by_name.size(); ++i) {
+            const size_t stop = layout.stops_by_name[i];
+            items_.push_back({MakeBox(layout.points[stop], render_settings.stop_radius), {Layer::STOP_CIRCLES, static_cast<uint32_t>(i), 0}});
+            if (!layout.stop_titles.empty() && layout.stop_titles[stop].hidden) {
                 continue;
             }
-            for (auto stop : catalogue_new.GetBusStops(bus)) {
-                unique_stops.insert(stop->name);
+            const svg::Point position = layout.stop_titles.empty() ? layout.points[stop] : layout.stop_titles[stop].position;
+            items_.push_back({GetTitleBox(position, render_settings.stop_label_offset, render_settings.stop_label_font_size,
+                                          layout.stop_names[stop], render_settings.underlayer_width),
+                              {Layer::STOP_TITLES, static_cast<uint32_t>(i), 0}});
+        }
+
+        if (items_.empty()) {
+            cell_starts_.assign(2, 0);
+            return;
+        }
+
+        bounds_ = items_.front().box;
+        for (const auto& item : items_) {
+            bounds_.min_x = std::min(bounds_.min_x, item.box.min_x);
+            bounds_.min_y = std::min(bounds_.min_y, item.box.min_y);
+            bounds_.max_x = std::max(bounds_.max_x, item.box.max_x);
+            bounds_.max_y = std::max(bounds_.max_y, item.box.max_y);
+        }
+        const size_t side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(items_.size()) / ITEMS_PER_CELL)));
+        columns_ = rows_ = std::clamp<size_t>(side, 1, MAX_GRID_SIDE);
+        cell_width_ = std::max((bounds_.max_x - bounds_.min_x) / columns_, EPSILON);
+        cell_height_ = std::max((bounds_.max_y - bounds_.min_y) / rows_, EPSILON);
+
+        // Items are put into every cell their boxes cover, counted first
+        auto for_each_cell = [this](const BoundingBox& box, auto func) {
+            for (size_t row = GetRow(box.min_y), last_row = GetRow(box.max_y); row <= last_row; ++row) {
+                for (size_t column = GetColumn(box.min_x), last_column = GetColumn(box.max_x); column <= last_column; ++column) {
+                    func(row * columns_ + column);
+                }
             }
+        };
+        cell_starts_.assign(columns_ * rows_ + 1, 0);
+        for (const auto& item : items_) {
+            for_each_cell(item.box, [this](size_t cell) {
+                ++cell_starts_[cell + 1];
+            });
         }
-        
-        for(auto circle : DrawCirlesForStops(catalogue_new, render_settings, unique_stops)){
-            doc.Add(circle);
+        std::partial_sum(cell_starts_.begin(), cell_starts_.end(), cell_starts_.begin());
+        cell_items_.resize(cell_starts_.back());
+        std::vector<uint32_t> filled(cell_starts_.begin(), cell_starts_.end() - 1);
+        for (size_t i = 0; i < items_.size(); ++i) {
+            for_each_cell(items_[i].box, [this, &filled, i](size_t cell) {
+                cell_items_[filled[cell]++] = static_cast<uint32_t>(i);
+            });
         }
-        
-        for(auto text : DrawTitlesForStops(catalogue_new, render_settings, unique_stops)){
-            doc.Add(text);
+    }
+
+    size_t MapIndex::GetColumn(double x) const {
+        const double column = std::floor((x - bounds_.min_x) / cell_width_);
+        return static_cast<size_t>(std::clamp(column, 0., static_cast<double>(columns_ - 1)));
+    }
+
+    size_t MapIndex::GetRow(double y) const {
+        const double row = std::floor((y - bounds_.min_y) / cell_height_);
+        return static_cast<size_t>(std::clamp(row, 0., static_cast<double>(rows_ - 1)));
+    }
+
+    std::vector<MapIndex::Element> MapIndex::Query(const BoundingBox& viewport) const {
+        std::vector<Element> result;
+        if (items_.empty() || !viewport.Intersects(bounds_)) {
+            return result;
         }
-        
-        std::ostringstream str_new;
-        doc.Render(str_new);
-        std::string new_data = str_new.str();
-        return new_data;
+        for (size_t row = GetRow(viewport.min_y), last_row = GetRow(viewport.max_y); row <= last_row; ++row) {
+            for (size_t column = GetColumn(viewport.min_x), last_column = GetColumn(viewport.max_x); column <= last_column; ++column) {
+                const size_t cell = row * columns_ + column;
+                for (size_t i = cell_starts_[cell]; i < cell_starts_[cell + 1]; ++i) {
+                    const Item& item = items_[cell_items_[i]];
+                    if (item.box.Intersects(viewport)) {
+                        result.push_back(item.element);
+                    }
+                }
+            }
+        }
+        // A route is found by each of its visible segments
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+    void DrawViewport(const MapLayout& layout, const MapStyles& styles, const MapIndex& index, const BoundingBox& viewport, svg::Writer& writer) {
+        using Layer = MapIndex::Layer;
+        writer.StartDocument({viewport.min_x, viewport.min_y}, {viewport.max_x - viewport.min_x, viewport.max_y - viewport.min_y});
+        for (const auto& element : index.Query(viewport)) {
+            switch (element.layer) {
+                case Layer::ROUTES:
+                    DrawRoute(layout, styles, element.index, element.index + 1, writer);
+                    break;
+                case Layer::ROUTE_TITLES:
+                    DrawRouteTitle(layout, styles, element.index, element.part, writer);
+                    break;
+                case Layer::STOP_CIRCLES:
+                    DrawCirlesForStops(layout, styles, element.index, element.index + 1, writer);
+                    break;
+                case Layer::STOP_TITLES:
+                    DrawTitlesForStops(layout, styles, element.index, element.index + 1, writer);
+                    break;
+            }
+        }
+        writer.EndDocument();
+    }
+
+    namespace {
+
+        // Bumped when the same inputs give another picture, so that the maps
+        // rendered by older builds are not read back
+        const uint64_t MAP_CACHE_VERSION = 2;
+
+        // Memory for the viewports rendered, a tile of a large map takes
+        // tens of kilobytes
+        const size_t VIEWPORT_CACHE_BYTES = 64 << 20;
+
+        // Colors and numbers are hashed the way they are written to the picture
+        std::string WriteRenderSettings(const RenderSettings& render_settings) {
+            std::ostringstream out;
+            out << std::setprecision(17) << render_settings.width << ' ' << render_settings.height << ' '
+                << render_settings.padding << ' ' << render_settings.line_width << ' ' << render_settings.stop_radius << ' '
+                << render_settings.bus_label_font_size << ' ' << render_settings.bus_label_offset.x << ' '
+                << render_settings.bus_label_offset.y << ' ' << render_settings.stop_label_font_size << ' '
+                << render_settings.stop_label_offset.x << ' ' << render_settings.stop_label_offset.y << ' '
+                << render_settings.underlayer_color << ' ' << render_settings.underlayer_width << ' '
+                << render_settings.simplify_tolerance << ' ' << render_settings.label_placement;
+            for (const auto& color : render_settings.color_palete) {
+                out << ' ' << color;
+            }
+            return out.str();
+        }
+
+        // 64-bit FNV-1a
+        class StableHash {
+        public:
+            void Add(std::string_view bytes) {
+                AddBytes(bytes.size());
+                for (const char c : bytes) {
+                    hash_ = (hash_ ^ static_cast<uint8_t>(c)) * PRIME;
+                }
+            }
+
+            // Numbers are hashed as their bytes
+            template <typename Value>
+            void AddBytes(Value value) {
+                char bytes[sizeof(Value)];
+                std::memcpy(bytes, &value, sizeof(Value));
+                for (const char c : bytes) {
+                    hash_ = (hash_ ^ static_cast<uint8_t>(c)) * PRIME;
+                }
+            }
+
+            uint64_t Get() const {
+                return hash_;
+            }
+
+        private:
+            static const uint64_t PRIME = 0x100000001b3ULL;
+            uint64_t hash_ = 0xcbf29ce484222325ULL;
+        };
+
+    }  // namespace
+
+    uint64_t HashMapInputs(const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render) {
+        StableHash hash;
+        hash.AddBytes(MAP_CACHE_VERSION);
+        hash.Add(WriteRenderSettings(render_settings));
+        const auto& buses_index = catalogue_new.GetBusesIndex();
+        for (const auto& bus : map_render.GetBuses()) {
+            const auto it = buses_index.find(bus);
+            if (it == buses_index.end() || it->second->stops.empty()) {
+                continue;
+            }
+            hash.Add(it->second->name);
+            hash.AddBytes(it->second->is_roundtrip);
+            hash.AddBytes(it->second->stops.size());
+            for (const auto* stop : it->second->stops) {
+                hash.Add(stop->name);
+                hash.AddBytes(stop->coord.lat);
+                hash.AddBytes(stop->coord.lng);
+            }
+        }
+        return hash.Get();
+    }
+
+    LazyMap::LazyMap(const catalogue::TransportCatalogue& catalogue_new, RenderSettings render_settings, const MapRender& map_render)
+        : catalogue_(catalogue_new)
+        , render_settings_(std::move(render_settings))
+        , map_render_(map_render)
+        , viewports_(VIEWPORT_CACHE_BYTES) {
+    }
+
+    void LazyMap::SetCacheDirectory(std::string path) {
+        cache_directory_ = std::move(path);
+    }
+
+    std::shared_future<std::string> LazyMap::GetRender(std::launch policy) {
+        std::lock_guard guard(svg_mutex_);
+        if (!svg_.valid()) {
+            svg_ = std::async(policy, [this] { return Render(); }).share();
+        }
+        return svg_;
+    }
+
+    void LazyMap::RenderAsync() {
+        GetRender(std::launch::async);
+    }
+
+    const std::string& LazyMap::GetJsonString() {
+        // Every thread waits on its own copy of the future, the string is
+        // kept by svg_
+        return GetRender(std::launch::deferred).get();
+    }
+
+    size_t LazyMap::ViewportHasher::operator()(const ViewportKey& key) const {
+        size_t hash = 0;
+        for (const double bound : key) {
+            hash = hash * 37 + std::hash<double>{}(bound);
+        }
+        return hash;
+    }
+
+    std::shared_ptr<const std::string> LazyMap::GetViewportJsonString(const BoundingBox& viewport) {
+        const ViewportKey key{viewport.min_x, viewport.min_y, viewport.max_x, viewport.max_y};
+        if (auto cached = viewports_.Find(key)) {
+            return cached;
+        }
+
+        const View& view = GetView();
+        const MapIndex& index = GetIndex();
+        std::string result = "\""s;
+        {
+            stats::ScopedTimer timer("map.viewport"sv);
+            svg::Writer writer(result, svg::Writer::Escaping::JSON);
+            DrawViewport(view.layout, view.styles, index, viewport, writer);
+        }
+        result += '"';
+
+        // Another thread may have rendered it meanwhile, then its result is kept
+        auto rendered = std::make_shared<const std::string>(std::move(result));
+        viewports_.Insert(key, rendered, sizeof(std::string) + rendered->size());
+        return rendered;
+    }
+
+    std::string_view LazyMap::GetJsonStringHead() {
+        const std::string_view map = GetJsonString();
+        return map.substr(0, map.size() - GetJsonStringTail().size());
+    }
+
+    std::string LazyMap::GetJourneyJsonString(const json::Array& items, std::string_view to) {
+        const View& view = GetView();
+        std::string result;
+        svg::Writer writer(result, svg::Writer::Escaping::JSON);
+        DrawJourney(view.layout, view.styles, items, to, writer);
+        return result;
+    }
+
+    std::string_view LazyMap::GetJsonStringTail() {
+        // The closing tag of the document and the closing quote of the string
+        return "</svg>\""sv;
+    }
+
+    const RenderSettings& LazyMap::GetRenderSettings() const {
+        return render_settings_;
+    }
+
+    std::string LazyMap::Render() {
+        std::string cache_path;
+        if (!cache_directory_.empty()) {
+            std::ostringstream name;
+            name << std::hex << std::setw(16) << std::setfill('0')
+                 << HashMapInputs(catalogue_, render_settings_, map_render_) << ".svg.json"sv;
+            cache_path = (std::filesystem::path(cache_directory_) / name.str()).string();
+            if (auto cached = ReadCachedMap(cache_path)) {
+                stats::AddCount("map.cache_hits"sv, 1);
+                stats::SetGauge("map.bytes"sv, cached->size());
+                return std::move(*cached);
+            }
+        }
+
+        const View& view = GetView();
+        std::string result = "\""s;
+        {
+            stats::ScopedTimer timer("map.draw"sv);
+            DrawMap(view.layout, view.styles, svg::Writer::Escaping::JSON, result);
+        }
+        result += '"';
+        stats::SetGauge("map.bytes"sv, result.size());
+
+        if (!cache_path.empty()) {
+            WriteCachedMap(cache_path, result);
+        }
+        return result;
+    }
+
+    std::optional<std::string> LazyMap::ReadCachedMap(const std::string& path) const {
+        std::ifstream input(path, std::ios::binary | std::ios::ate);
+        if (!input) {
+            return std::nullopt;
+        }
+        std::string result(static_cast<size_t>(input.tellg()), '\0');
+        input.seekg(0);
+        input.read(result.data(), result.size());
+        // A file cut short or not made by WriteCachedMap is rendered anew
+        const std::string_view tail = GetJsonStringTail();
+        if (!input || result.size() <= tail.size() || result.front() != '"'
+            || result.compare(result.size() - tail.size(), tail.size(), tail) != 0) {
+            return std::nullopt;
+        }
+        return result;
+    }
+
+    void LazyMap::WriteCachedMap(const std::string& path, const std::string& map) const {
+        // Other processes see either no file or the whole of it. The cache
+        // only saves time, so the map is not kept if it cannot be written.
+        std::error_code error;
+        std::filesystem::create_directories(cache_directory_, error);
+        const std::string temp_path = path + '.' + std::to_string(std::random_device{}()) + ".tmp"s;
+        {
+            std::ofstream output(temp_path, std::ios::binary);
+            if (!output.write(map.data(), map.size()).flush()) {
+                output.close();
+                std::filesystem::remove(temp_path, error);
+                return;
+            }
+        }
+        std::filesystem::rename(temp_path, path, error);
+        if (error) {
+            std::filesystem::remove(temp_path, error);
+        }
+    }
+
+    const LazyMap::View& LazyMap::GetView() {
+        std::call_once(view_once_, [this] {
+            stats::ScopedTimer timer("map.layout"sv);
+            std::string unused;
+            const svg::Writer writer(unused, svg::Writer::Escaping::JSON);
+            view_ = std::make_unique<View>(View{MakeMapLayout(catalogue_, render_settings_, map_render_),
+                                                MakeMapStyles(render_settings_, writer)});
+        });
+        return *view_;
+    }
+
+    const MapIndex& LazyMap::GetIndex() {
+        std::call_once(index_once_, [this] {
+            const View& view = GetView();
+            stats::ScopedTimer timer("map.index"sv);
+            index_ = std::make_unique<MapIndex>(view.layout, render_settings_);
+        });
+        return *index_;
     }
     
 
@@ -3,16 +3,22 @@
 #include "geo.h"
 #include "svg.h"
 #include "json.h"
+#include "lru_cache.h"
 #include "transport_catalogue.h"
 
 #include <algorithm>
 #include <cstdlib>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <iostream>
 #include <optional>
 #include <vector>
 #include <utility>
 #include <array>
 #include <set>
+#include <string_view>
 
 namespace map_render {
     struct RenderSettings {
@@ -29,27 +35,246 @@ namespace map_render {
         svg::Color underlayer_color;
         double underlayer_width;
         std::vector<svg::Color> color_palete;
+        // Route lines are simplified so that they deviate from the stops by
+        // no more than this, in the picture units. 0 keeps every stop.
+        double simplify_tolerance = 0.;
+        // Titles are moved around their points or left out, so that they
+        // do not overlap each other
+        bool label_placement = false;
     };
 
     class MapRender {
     public:
         void AddBus(std::string bus);
-        std::set<std::string> GetBuses() const;
+        const std::set<std::string>& GetBuses() const;
 
     private:
         std::set<std::string> buses_;
     };
+
+    // Stops and routes of the map projected onto the picture. Every stop
+    // on the routes is projected once, layers refer to it by index.
+    struct MapLayout {
+        struct Route {
+            std::string_view bus;
+            bool is_roundtrip;
+            // Indexes of the route stops in points
+            std::vector<size_t> stops;
+            // Vertexes of the route line, the same as stops unless simplified
+            std::vector<size_t> line;
+        };
+
+        // Where a title is drawn after label placement
+        struct Title {
+            // Passed to the text as its point, the offset from the settings is kept
+            svg::Point position;
+            // Every place tried overlaps the titles placed before
+            bool hidden = false;
+        };
+
+        std::vector<svg::Point> points;
+        // Stop names, in the same order as points
+        std::vector<std::string_view> stop_names;
+        // Indexes of points in the order of stop names
+        std::vector<size_t> stops_by_name;
+        // Routes with stops, in the order of bus names
+        std::vector<Route> routes;
+        // Stops on all the routes and vertexes of the route lines drawn
+        size_t route_stop_count = 0;
+        size_t line_vertex_count = 0;
+        // Filled with label placement on only, otherwise every title is drawn at its stop.
+        // Two titles for a route: at the first and at the final stop.
+        std::vector<std::array<Title, 2>> route_titles;
+        // In the same order as points
+        std::vector<Title> stop_titles;
+        size_t moved_title_count = 0;
+        size_t hidden_title_count = 0;
+    };
+    
+    // Attributes of the map elements, rendered once for all of them
+    struct MapStyles {
+        // Indexed by the route color
+        std::vector<std::string> route_lines;
+        std::vector<std::string> route_titles;
+        std::string route_title_underlayer;
+        std::string route_title_font;
+        std::string stop_circle;
+        double stop_radius = 0.;
+        std::string stop_title_underlayer;
+        std::string stop_title;
+        std::string stop_title_font;
+        // The journey drawn over the map: wider lines over an underlayer, indexed by the route color
+        std::vector<std::string> journey_lines;
+        std::string journey_underlayer;
+    };
     
     svg::Color FillCollor(const json::Node& color);
     
     RenderSettings FillRenderSettings(const json::Dict& settings);
-    std::vector<svg::Polyline> DrawRoute(const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render);
-    std::pair<svg::Text, svg::Text> FillTextForRoutes(const RenderSettings& render_settings, svg::Point& new_point, const std::string& bus, int color_index);
-    std::pair<svg::Text, svg::Text> FillTextForStops(const RenderSettings& render_settings, svg::Point& new_point, const std::string& stop);
-    std::vector<svg::Circle> DrawCirlesForStops (const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, std::set<std::string>& unique_stops);
-    std::vector<svg::Text> DrawTitlesForRoutes (const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render);
-    std::vector<svg::Text> DrawTitlesForStops (const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, std::set<std::string>& unique_stops);
+    MapLayout MakeMapLayout(const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render);
+    // Styles are escaped the way the writer needs
+    MapStyles MakeMapStyles(const RenderSettings& render_settings, const svg::Writer& writer);
+    // Layers are drawn for the routes or the stops in [first, last) of the layout
+    void DrawRoute(const MapLayout& layout, const MapStyles& styles, size_t first, size_t last, svg::Writer& writer);
+    void DrawCirlesForStops (const MapLayout& layout, const MapStyles& styles, size_t first, size_t last, svg::Writer& writer);
+    void DrawTitlesForRoutes (const MapLayout& layout, const MapStyles& styles, size_t first, size_t last, svg::Writer& writer);
+    // The title of the route at the first stop for part 0 or at the final one for part 1
+    void DrawRouteTitle(const MapLayout& layout, const MapStyles& styles, size_t route, size_t part, svg::Writer& writer);
+    void DrawTitlesForStops (const MapLayout& layout, const MapStyles& styles, size_t first, size_t last, svg::Writer& writer);
+    // The journey of a Route answer drawn over the map: its rides, the stops
+    // on them, the buses at the stops where they are boarded and the names
+    // of the stops where rides begin and end. items are the "items" of the
+    // answer, to is the stop the journey ends at.
+    void DrawJourney(const MapLayout& layout, const MapStyles& styles, const json::Array& items, std::string_view to, svg::Writer& writer);
+    // Layers are split into pieces drawn on the thread pool, then the pieces
+    // are appended to the output in the order of the map
+    void DrawMap(const MapLayout& layout, const MapStyles& styles, svg::Writer::Escaping escaping, std::string& output);
     std::string FillSvgDocument(const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render);
+    // The map as a JSON string literal, quotes included
+    std::string FillSvgJsonString(const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render);
+
+    // Area of the picture, in its coordinates
+    struct BoundingBox {
+        double min_x = 0.;
+        double min_y = 0.;
+        double max_x = 0.;
+        double max_y = 0.;
+
+        bool Intersects(const BoundingBox& other) const {
+            return min_x <= other.max_x && other.min_x <= max_x && min_y <= other.max_y && other.min_y <= max_y;
+        }
+    };
+
+    // The picture is split into 2^z x 2^z tiles, x and y count from the top left one
+    BoundingBox GetTileBox(const RenderSettings& render_settings, int z, int x, int y);
+    // The viewport of a Map request with "bbox": [min_x, min_y, max_x, max_y]
+    // or "tile": {"z": z, "x": x, "y": y}. Nothing if the whole map is requested.
+    std::optional<BoundingBox> FillViewport(const json::Dict& request, const RenderSettings& render_settings);
+
+    // Uniform grid over the boxes of the map elements: route segments, titles
+    // and stop circles. A viewport query looks only at the cells it covers,
+    // so its cost depends on the visible part of the map.
+    class MapIndex {
+    public:
+        enum class Layer : uint8_t {
+            ROUTES,
+            ROUTE_TITLES,
+            STOP_CIRCLES,
+            STOP_TITLES,
+        };
+
+        struct Element {
+            Layer layer;
+            // Index of the route, or index in stops_by_name
+            uint32_t index;
+            // Route titles: 0 at the first stop, 1 at the final one
+            uint8_t part;
+
+            // Elements are drawn in this order
+            bool operator<(const Element& other) const {
+                return std::tie(layer, index, part) < std::tie(other.layer, other.index, other.part);
+            }
+            bool operator==(const Element& other) const {
+                return layer == other.layer && index == other.index && part == other.part;
+            }
+        };
+
+        MapIndex(const MapLayout& layout, const RenderSettings& render_settings);
+
+        // Elements which may intersect the viewport, in drawing order
+        std::vector<Element> Query(const BoundingBox& viewport) const;
+
+    private:
+        struct Item {
+            BoundingBox box;
+            Element element;
+        };
+
+        size_t GetColumn(double x) const;
+        size_t GetRow(double y) const;
+
+        std::vector<Item> items_;
+        BoundingBox bounds_;
+        size_t columns_ = 1;
+        size_t rows_ = 1;
+        double cell_width_ = 1.;
+        double cell_height_ = 1.;
+        // Items of the cell i are cell_items_[cell_starts_[i], cell_starts_[i + 1])
+        std::vector<uint32_t> cell_starts_;
+        std::vector<uint32_t> cell_items_;
+    };
+
+    // Only the elements which intersect the viewport, the viewBox is set to it
+    void DrawViewport(const MapLayout& layout, const MapStyles& styles, const MapIndex& index, const BoundingBox& viewport, svg::Writer& writer);
+
+    // The same in every run and build: everything the map depends on,
+    // the buses with their stop names and coordinates and the settings
+    uint64_t HashMapInputs(const catalogue::TransportCatalogue& catalogue_new, const RenderSettings& render_settings, const MapRender& map_render);
+
+    // The map is rendered on the first request only and then kept as a
+    // JSON string literal, which is put into every Map answer as is.
+    // The catalogue and the buses must outlive it and not change.
+    class LazyMap {
+    public:
+        LazyMap(const catalogue::TransportCatalogue& catalogue_new, RenderSettings render_settings, const MapRender& map_render);
+
+        // Rendered maps are kept in the directory, named by HashMapInputs, and
+        // are read back instead of rendering by the runs with the same inputs.
+        // Must be set before the map is rendered.
+        void SetCacheDirectory(std::string path);
+        // Starts rendering on another thread, if it has not been started yet
+        void RenderAsync();
+        // Renders the map or waits until RenderAsync finishes it
+        const std::string& GetJsonString();
+        // Part of the map, see DrawViewport. The layout and the spatial index
+        // are shared by all the viewports. The viewports rendered are kept
+        // within a memory budget, the ones asked for least recently are
+        // dropped: clients of a server may ask for any number of them.
+        std::shared_ptr<const std::string> GetViewportJsonString(const BoundingBox& viewport);
+        // The map with a journey drawn over it is the head, the journey and the
+        // tail one after another. The head is cut from the rendered map, so
+        // only the journey is drawn for every request, see DrawJourney.
+        std::string_view GetJsonStringHead();
+        std::string GetJourneyJsonString(const json::Array& items, std::string_view to);
+        static std::string_view GetJsonStringTail();
+        const RenderSettings& GetRenderSettings() const;
+
+    private:
+        struct View {
+            MapLayout layout;
+            MapStyles styles;
+        };
+        // The settings are the same for all the viewports of the map, the
+        // bounds are enough for a key
+        using ViewportKey = std::array<double, 4>;
+        struct ViewportHasher {
+            size_t operator()(const ViewportKey& key) const;
+        };
+        using ViewportCache = lru_cache::LruCache<ViewportKey, std::string, ViewportHasher>;
+
+        std::string Render();
+        // The rendered map, rendering is started with the policy if it has
+        // not been started yet
+        std::shared_future<std::string> GetRender(std::launch policy);
+        // Nothing if there is no cache or no such map in it
+        std::optional<std::string> ReadCachedMap(const std::string& path) const;
+        void WriteCachedMap(const std::string& path, const std::string& map) const;
+        const View& GetView();
+        const MapIndex& GetIndex();
+
+        const catalogue::TransportCatalogue& catalogue_;
+        RenderSettings render_settings_;
+        const MapRender& map_render_;
+        std::mutex svg_mutex_;
+        std::shared_future<std::string> svg_;
+        std::string cache_directory_;
+
+        std::once_flag view_once_;
+        std::unique_ptr<View> view_;
+        std::once_flag index_once_;
+        std::unique_ptr<MapIndex> index_;
+        ViewportCache viewports_;
+    };
 
 }  // namespace map_render
 
@@ -0,0 +1,316 @@
+#include "request_handler.h"
+#include "json_reader.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+using namespace std::literals;
+
+namespace request_handler {
+
+    namespace {
+        // Requests of these types get the same answers but for the ids, they
+        // are kept by the memo under the type and the parameters. Map answers
+        // are kept by LazyMap already. RouteMap answers hold the whole map,
+        // every pair of stops would keep a copy of it; their cost is in the
+        // route drawn, which is as long as the route.
+        std::string MakeMemoKey(std::string_view type, const json::Dict& data) {
+            std::string key;
+            const auto add = [&key](std::string_view part) {
+                key += part;
+                key.push_back('\0');
+            };
+            if (type == "Stop"sv || type == "Bus"sv) {
+                add(type);
+                add(data.at("name").AsString());
+            } else if (type == "Route"sv) {
+                add(type);
+                add(data.at("from").AsString());
+                add(data.at("to").AsString());
+            }
+            return key;
+        }
+
+        // The counters may outgrow int, they are written as integers anyway
+        void WriteCount(json::StreamBuilder& answer, std::string_view name, int64_t value) {
+            char text[24];
+            const auto end = std::to_chars(text, text + sizeof(text), value).ptr;
+            answer.Key(name).RawValue(std::string_view(text, end - text));
+        }
+
+        void AddCacheStats(std::string_view prefix, const lru_cache::CacheStats& cache,
+                           std::map<std::string, int64_t, std::less<>>& counters) {
+            const std::string name(prefix);
+            counters[name + "bytes"] = cache.bytes;
+            counters[name + "entries"] = cache.entries;
+            counters[name + "evictions"] = cache.evictions;
+            counters[name + "hits"] = cache.hits;
+            counters[name + "misses"] = cache.misses;
+        }
+
+        void WriteLatencies(json::StreamBuilder& answer, const stats::Latencies& latencies) {
+            answer.StartDict();
+            for (const auto& [type, latency] : latencies) {
+                answer.Key(type).StartDict();
+                WriteCount(answer, "count"sv, static_cast<int64_t>(latency.count));
+                answer.Key("max_ms"sv).Value(latency.max_ms).Key("p50_ms"sv).Value(latency.p50_ms)
+                    .Key("p90_ms"sv).Value(latency.p90_ms).Key("p99.9_ms"sv).Value(latency.p999_ms)
+                    .Key("p99_ms"sv).Value(latency.p99_ms).EndDict();
+            }
+            answer.EndDict();
+        }
+
+        // The name of the span of a request. The type itself is kept by the
+        // document of the request, which is gone by the time it is traced.
+        std::string_view GetSpanName(std::string_view type) {
+            for (const std::string_view name : {"Stop"sv, "Bus"sv, "Route"sv, "Map"sv, "RouteMap"sv, "Stats"sv}) {
+                if (type == name) {
+                    return name;
+                }
+            }
+            return "Unknown"sv;
+        }
+
+        // Requests answered by one task: many enough to pay for the task, few
+        // enough for the threads to share the work evenly
+        const size_t PART_SIZE = 16;
+        // Parts answered ahead of the one appended, for every thread. Few of
+        // them keep the buffers small and reused, maps take megabytes each.
+        const size_t PARTS_PER_THREAD = 4;
+    }
+
+    RequestHandler::RequestHandler(const catalogue::TransportCatalogue& catalogue, map_render::LazyMap& map,
+                                   const router::TransportRouter& transport_router, RouterFuture router)
+        : catalogue_(catalogue)
+        , map_(map)
+        , transport_router_(transport_router)
+        , router_(std::move(router)) {
+    }
+
+    void RequestHandler::EnableMemo(size_t budget_bytes) {
+        memo_ = std::make_unique<Memo>(budget_bytes);
+    }
+
+    lru_cache::CacheStats RequestHandler::GetMemoStats() const {
+        return memo_ ? memo_->GetStats() : lru_cache::CacheStats{};
+    }
+
+    bool RequestHandler::Answer(const json::Node& request, json::StreamBuilder& answer) {
+        const json::Dict& data = request.AsMap();
+        int id = data.at("id").AsInt();
+        const std::string_view type = data.at("type").AsString();
+        const trace::Span span(trace::IsEnabled() ? GetSpanName(type) : ""sv, "request"sv, id);
+        if (!stats::IsEnabled()) {
+            return AnswerWithMemo(data, id, type, answer);
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const bool answered = AnswerWithMemo(data, id, type, answer);
+        stats::AddLatency(type, std::chrono::steady_clock::now() - start);
+        return answered;
+    }
+
+    bool RequestHandler::AnswerWithMemo(const json::Dict& data, int id, std::string_view type, json::StreamBuilder& answer) {
+        std::string key = memo_ ? MakeMemoKey(type, data) : std::string();
+        if (key.empty()) {
+            return Answer(data, id, type, answer);
+        }
+
+        char id_text[16];
+        const auto id_end = std::to_chars(id_text, id_text + sizeof(id_text), id).ptr;
+        if (const auto memo_answer = memo_->Find(key)) {
+            answer.RawValue({memo_answer->head, std::string_view(id_text, id_end - id_text), memo_answer->tail});
+            return true;
+        }
+
+        const size_t start = answer.GetOutput().size();
+        if (!Answer(data, id, type, answer)) {
+            return false;
+        }
+        // The answer without the separator and the indent before it. Only the
+        // answer dict itself has "request_id" for a key, inside the strings
+        // quotes are escaped.
+        std::string_view text = answer.GetOutput().substr(start);
+        text.remove_prefix(std::min(text.size(), text.find_first_not_of(",\n ")));
+        const std::string_view id_key = "\"request_id\": "sv;
+        const std::string_view id_view(id_text, id_end - id_text);
+        size_t id_begin = text.find(id_key);
+        if (id_begin == text.npos) {
+            return true;
+        }
+        id_begin += id_key.size();
+        if (text.substr(id_begin, id_view.size()) != id_view) {
+            return true;
+        }
+        auto memo_answer = std::make_shared<MemoAnswer>();
+        memo_answer->head = text.substr(0, id_begin);
+        memo_answer->tail = text.substr(id_begin + id_view.size());
+        const size_t bytes = sizeof(MemoAnswer) + key.size() + memo_answer->head.size() + memo_answer->tail.size();
+        memo_->Insert(std::move(key), std::move(memo_answer), bytes);
+        return true;
+    }
+
+    bool RequestHandler::Answer(const json::Dict& data, int id, std::string_view type, json::StreamBuilder& answer) {
+        if (type == "Stop" || type == "Bus") {
+            json_reader::GetAnswer(answer, id, type, data.at("name").AsString(), catalogue_);
+        }
+        else if (type == "Map") {
+            // A bbox or a tile asks for a part of the map only
+            const auto viewport = map_render::FillViewport(data, map_.GetRenderSettings());
+            const std::shared_ptr<const std::string> part = viewport ? map_.GetViewportJsonString(*viewport) : nullptr;
+            answer.StartDict().Key("map"sv).RawValue(part ? *part : map_.GetJsonString()).Key("request_id"sv).Value(id).EndDict();
+        }
+        else if (type == "Route") {
+            std::string_view from = data.at("from").AsString();
+            std::string_view to = data.at("to").AsString();
+            answer.Value(json::Node(transport_router_.GetGraphData(from, to, id, *router_.get())));
+        }
+        else if (type == "RouteMap") {
+            // The route found as for a Route request, drawn over the map
+            std::string_view from = data.at("from").AsString();
+            std::string_view to = data.at("to").AsString();
+            json::Dict route = transport_router_.GetGraphData(from, to, id, *router_.get());
+            if (route.count("items")) {
+                const std::string journey = map_.GetJourneyJsonString(route.at("items").AsArray(), to);
+                answer.StartDict().Key("map"sv).RawValue({map_.GetJsonStringHead(), journey, map_.GetJsonStringTail()})
+                    .Key("request_id"sv).Value(id).EndDict();
+            } else {
+                answer.Value(json::Node(std::move(route)));
+            }
+        }
+        else if (type == "Stats") {
+            // Timers, counters and latencies are recorded from the first Stats
+            // request on, a server starts a new window of latencies with reset_window
+            stats::Enable();
+            WriteStats(id, data.count("reset_window") && data.at("reset_window").AsBool(), answer);
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    void RequestHandler::WriteStats(int id, bool reset_window, json::StreamBuilder& answer) const {
+        // Keys are written sorted, as json::Print does
+        stats::Snapshot snapshot = stats::GetSnapshot();
+        AddCacheStats("memo."sv, GetMemoStats(), snapshot.counters);
+        AddCacheStats("route_cache."sv, transport_router_.GetRouteCacheStats(), snapshot.counters);
+        answer.StartDict().Key("counters"sv).StartDict();
+        for (const auto& [name, value] : snapshot.counters) {
+            WriteCount(answer, name, value);
+        }
+        answer.EndDict().Key("latencies"sv);
+        WriteLatencies(answer, snapshot.latencies);
+        answer.Key("latency_window"sv);
+        WriteLatencies(answer, stats::GetLatencyWindow(reset_window));
+        answer.Key("request_id"sv).Value(id).Key("timers"sv).StartDict();
+        for (const auto& [name, timer] : snapshot.timers) {
+            answer.Key(name).StartDict();
+            WriteCount(answer, "count"sv, static_cast<int64_t>(timer.count));
+            answer.Key("max_ms"sv).Value(timer.max_ms).Key("total_ms"sv).Value(timer.total_ms).EndDict();
+        }
+        answer.EndDict().EndDict();
+    }
+
+    void RequestHandler::AnswerAll(const json::Array& requests, json::StreamBuilder& answer,
+                                   const std::function<void()>& flush) {
+        // The time of the flushes is counted too, they may wait for the output
+        stats::ScopedTimer timer("answer"sv);
+        stats::AddCount("answer.requests"sv, static_cast<int64_t>(requests.size()));
+        thread_pool::ThreadPool& pool = thread_pool::GetDefaultPool();
+        if (pool.GetThreadCount() < 2) {
+            // The parts would take turns on one core, with nothing to gain
+            for (const auto& request : requests) {
+                Answer(request, answer);
+                if (flush) {
+                    flush();
+                }
+            }
+            return;
+        }
+
+        // A part is put into a slot until it is appended, the next parts are
+        // answered meanwhile. A slow part holds back only the appending, not
+        // the threads answering the parts after it.
+        struct Slot {
+            explicit Slot(const json::StreamBuilder& answer)
+                : items(answer.ForItems(buffer)) {
+            }
+
+            std::string buffer;
+            json::StreamBuilder items;
+            std::future<void> done;
+        };
+
+        const size_t part_count = (requests.size() + PART_SIZE - 1) / PART_SIZE;
+        // Slots are kept with their buffers, part i goes to slot i % size
+        std::deque<Slot> slots;
+        for (size_t i = 0; i < std::min(part_count, PARTS_PER_THREAD * (pool.GetThreadCount() + 1)); ++i) {
+            slots.emplace_back(answer);
+        }
+        const auto submit = [&](size_t part) {
+            Slot& slot = slots[part % slots.size()];
+            slot.done = pool.Submit([this, &requests, &slot, part] {
+                slot.buffer.clear();
+                const size_t begin = part * PART_SIZE;
+                const size_t end = std::min(begin + PART_SIZE, requests.size());
+                for (size_t i = begin; i < end; ++i) {
+                    Answer(requests[i], slot.items);
+                }
+            });
+        };
+
+        for (size_t part = 0; part < slots.size(); ++part) {
+            submit(part);
+        }
+        try {
+            for (size_t part = 0; part < part_count; ++part) {
+                Slot& slot = slots[part % slots.size()];
+                // Waiting for the part, the thread answers other ones
+                while (slot.done.wait_for(std::chrono::seconds(0)) != std::future_status::ready
+                       && pool.RunPendingTask()) {
+                }
+                slot.done.get();
+                answer.RawItems(slot.buffer);
+                if (flush) {
+                    flush();
+                }
+                if (part + slots.size() < part_count) {
+                    submit(part + slots.size());
+                }
+            }
+        } catch (...) {
+            // The parts still answered write into the slots
+            for (Slot& slot : slots) {
+                if (slot.done.valid()) {
+                    slot.done.wait();
+                }
+            }
+            throw;
+        }
+    }
+
+    bool HasMapRequests(const json::Array& stat_requests) {
+        return std::any_of(stat_requests.begin(), stat_requests.end(), [](const json::Node& data) {
+            const std::string_view type = data.AsMap().at("type").AsString();
+            return type == "Map"sv || type == "RouteMap"sv;
+        });
+    }
+
+    bool HasRouteRequests(const json::Array& stat_requests) {
+        return std::any_of(stat_requests.begin(), stat_requests.end(), [](const json::Node& data) {
+            const std::string_view type = data.AsMap().at("type").AsString();
+            return type == "Route"sv || type == "RouteMap"sv;
+        });
+    }
+
+}  // namespace request_handler
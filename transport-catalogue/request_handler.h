@@ -0,0 +1,82 @@
+#pragma once
+
+#include "graph.h"
+#include "json.h"
+#include "json_builder.h"
+#include "lru_cache.h"
+#include "map_renderer.h"
+#include "router.h"
+#include "transport_catalogue.h"
+#include "transport_router.h"
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace request_handler {
+
+    // The router takes long to build, it is built on another thread while
+    // the requests which do not need it are answered
+    using RouterFuture = std::shared_future<const graph::Router<double>*>;
+
+    // Answers stat requests against the catalogue, the map and the router
+    // built from the base requests. They must outlive the handler. Route
+    // requests wait for the router, its graph is made by then.
+    class RequestHandler {
+    public:
+        RequestHandler(const catalogue::TransportCatalogue& catalogue, map_render::LazyMap& map,
+                       const router::TransportRouter& transport_router, RouterFuture router);
+
+        // Keeps the answers to Stop, Bus and Route requests in a memo
+        // shared by all threads, within the budget. A request asked
+        // again gets the answer kept with its own id put in. The answers
+        // are kept as written, so they must all be written at the same depth
+        // or in the LINE format.
+        void EnableMemo(size_t budget_bytes);
+        lru_cache::CacheStats GetMemoStats() const;
+
+        // Writes the answer to one request. Requests of unknown types are
+        // not answered, then false is returned. Requests may be answered
+        // on many threads at once, each with its own builder.
+        bool Answer(const json::Node& request, json::StreamBuilder& answer);
+        // Writes the answers as the items of the current array of the builder,
+        // in the order of the requests. Parts of the requests are answered on
+        // the default pool at once, each into its own buffer, and appended in
+        // order as soon as they are ready. flush is called after every part
+        // appended, if given.
+        // With a single thread in the pool the answers are written in place.
+        void AnswerAll(const json::Array& requests, json::StreamBuilder& answer,
+                       const std::function<void()>& flush = {});
+
+    private:
+        // An answer kept by the memo with the request id cut out
+        struct MemoAnswer {
+            std::string head;
+            std::string tail;
+        };
+        using Memo = lru_cache::LruCache<std::string, MemoAnswer>;
+
+        // The answer kept by the memo, or the one written and then kept
+        bool AnswerWithMemo(const json::Dict& data, int id, std::string_view type, json::StreamBuilder& answer);
+        bool Answer(const json::Dict& data, int id, std::string_view type, json::StreamBuilder& answer);
+        // The answer to a Stats request: the timers, the counters and the
+        // latencies of the stats registry, with the counters of the memo and
+        // the route cache. The latencies since the start go along with the
+        // ones of the current window, which a server may start anew.
+        void WriteStats(int id, bool reset_window, json::StreamBuilder& answer) const;
+
+        const catalogue::TransportCatalogue& catalogue_;
+        map_render::LazyMap& map_;
+        const router::TransportRouter& transport_router_;
+        RouterFuture router_;
+        std::unique_ptr<Memo> memo_;
+    };
+
+    // Map and RouteMap requests need the map rendered
+    bool HasMapRequests(const json::Array& stat_requests);
+    // Route and RouteMap requests need the router built
+    bool HasRouteRequests(const json::Array& stat_requests);
+
+}  // namespace request_handler
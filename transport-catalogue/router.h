@@ -28,6 +28,8 @@ public:
     };
 
     std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
+    // Memory taken by the table of the best routes between all the vertexes
+    size_t GetTableBytes() const;
 
 private:
     struct RouteInternalData {
@@ -94,6 +96,15 @@ Router<Weight>::Router(const Graph& graph)
     }
 }
 
+template <typename Weight>
+size_t Router<Weight>::GetTableBytes() const {
+    size_t bytes = routes_internal_data_.capacity() * sizeof(routes_internal_data_[0]);
+    for (const auto& row : routes_internal_data_) {
+        bytes += row.capacity() * sizeof(row[0]);
+    }
+    return bytes;
+}
+
 template <typename Weight>
 std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexId from,
                                                                              VertexId to) const {
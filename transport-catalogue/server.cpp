@@ -0,0 +1,600 @@
+#include "server.h"
+#include "json_builder.h"
+#include "json_reader.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#define SERVER_EPOLL
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std::literals;
+
+namespace server {
+
+namespace {
+
+    void WriteError(std::string_view message, std::string& output) {
+        json::StreamBuilder answer(output, json::StreamBuilder::Format::LINE);
+        answer.StartDict().Key("error_message"sv).Value(message).EndDict().Build();
+        output.push_back('\n');
+    }
+
+#ifdef SERVER_EPOLL
+    // Closes the descriptor when it goes out of scope
+    class FileDescriptor {
+    public:
+        explicit FileDescriptor(int fd = -1)
+            : fd_(fd) {
+        }
+        FileDescriptor(const FileDescriptor&) = delete;
+        FileDescriptor& operator=(const FileDescriptor&) = delete;
+        FileDescriptor(FileDescriptor&& other) noexcept
+            : fd_(std::exchange(other.fd_, -1)) {
+        }
+        FileDescriptor& operator=(FileDescriptor&& other) noexcept {
+            std::swap(fd_, other.fd_);
+            return *this;
+        }
+        ~FileDescriptor() {
+            if (fd_ >= 0) {
+                close(fd_);
+            }
+        }
+
+        int Get() const {
+            return fd_;
+        }
+
+    private:
+        int fd_;
+    };
+
+    std::runtime_error MakeSystemError(const std::string& what) {
+        return std::runtime_error(what + ": " + std::strerror(errno));
+    }
+
+    // A socket file left by a previous run is removed. Any other file, or
+    // the socket of a server still running, is kept and the path is in use.
+    void RemoveStaleSocket(const std::string& path, const sockaddr_un& address) {
+        struct stat status{};
+        if (lstat(path.c_str(), &status) != 0) {
+            if (errno == ENOENT) {
+                return;
+            }
+            throw MakeSystemError("Cannot listen on " + path);
+        }
+        if (S_ISSOCK(status.st_mode)) {
+            const FileDescriptor probe(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+            if (probe.Get() >= 0 && connect(probe.Get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+                && errno == ECONNREFUSED) {
+                unlink(path.c_str());
+                return;
+            }
+        }
+        throw std::runtime_error("Cannot listen on " + path + ": address in use");
+    }
+
+    // The inode of the socket file is kept, so only that file is removed at the end
+    FileDescriptor Listen(const SocketSettings& settings, ino_t& socket_inode) {
+        if (!settings.path.empty()) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (settings.path.size() >= sizeof(address.sun_path)) {
+                throw std::runtime_error("Socket path is too long: " + settings.path);
+            }
+            std::memcpy(address.sun_path, settings.path.c_str(), settings.path.size() + 1);
+            FileDescriptor listener(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+            if (listener.Get() < 0) {
+                throw MakeSystemError("Cannot listen on " + settings.path);
+            }
+            RemoveStaleSocket(settings.path, address);
+            if (bind(listener.Get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+                throw MakeSystemError("Cannot listen on " + settings.path);
+            }
+            struct stat status{};
+            if (lstat(settings.path.c_str(), &status) == 0) {
+                socket_inode = status.st_ino;
+            }
+            if (listen(listener.Get(), SOMAXCONN) != 0) {
+                throw MakeSystemError("Cannot listen on " + settings.path);
+            }
+            return listener;
+        }
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(settings.port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        FileDescriptor listener(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+        const int on = 1;
+        if (listener.Get() < 0 || setsockopt(listener.Get(), SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0
+            || bind(listener.Get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+            || listen(listener.Get(), SOMAXCONN) != 0) {
+            throw MakeSystemError("Cannot listen on port " + std::to_string(settings.port));
+        }
+        return listener;
+    }
+
+    // Set by SIGINT and SIGTERM, which wake the epoll thread through the
+    // eventfd of its notifier
+    std::atomic<bool> stop_requested = false;
+    std::atomic<int> stop_fd = -1;
+
+    void RequestStop(int) {
+        const int saved_errno = errno;
+        stop_requested.store(true);
+        if (const int fd = stop_fd.load(); fd >= 0) {
+            const uint64_t one = 1;
+            [[maybe_unused]] const ssize_t written = write(fd, &one, sizeof(one));
+        }
+        errno = saved_errno;
+    }
+
+    // Handles the signals while the server runs, the previous handlers are put back after
+    class StopSignals {
+    public:
+        explicit StopSignals(int wake_fd) {
+            stop_requested = false;
+            stop_fd = wake_fd;
+            struct sigaction action{};
+            action.sa_handler = RequestStop;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGINT, &action, &previous_int_);
+            sigaction(SIGTERM, &action, &previous_term_);
+        }
+        StopSignals(const StopSignals&) = delete;
+        StopSignals& operator=(const StopSignals&) = delete;
+        ~StopSignals() {
+            sigaction(SIGINT, &previous_int_, nullptr);
+            sigaction(SIGTERM, &previous_term_, nullptr);
+            stop_fd = -1;
+        }
+
+    private:
+        struct sigaction previous_int_{};
+        struct sigaction previous_term_{};
+    };
+
+    // The answer to one line, written by a worker
+    struct Slot {
+        std::string answer;
+        std::atomic<bool> done = false;
+    };
+
+    struct Connection {
+        FileDescriptor fd;
+        // Received, up to the end of the last line taken
+        std::string input;
+        // Lines being answered, in the order they came
+        std::deque<std::shared_ptr<Slot>> slots;
+        // Answers to send, output[sent, size) is left
+        std::string output;
+        size_t sent = 0;
+        uint32_t events = 0;
+        // The client sent everything, or said "exit", which closes only its connection
+        bool input_closed = false;
+        bool exiting = false;
+        // The line after the ones in input is too long, it gets an error
+        bool line_too_long = false;
+    };
+
+    // Workers report the connections with new answers to the epoll thread
+    class Notifier {
+    public:
+        Notifier()
+            : fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+            if (fd_.Get() < 0) {
+                throw MakeSystemError("Cannot create eventfd");
+            }
+        }
+
+        int GetFd() const {
+            return fd_.Get();
+        }
+
+        void Notify(uint64_t connection) {
+            {
+                std::lock_guard guard(mutex_);
+                connections_.push_back(connection);
+            }
+            const uint64_t one = 1;
+            [[maybe_unused]] const ssize_t written = write(fd_.Get(), &one, sizeof(one));
+        }
+
+        std::vector<uint64_t> Take() {
+            uint64_t count;
+            [[maybe_unused]] const ssize_t read_size = read(fd_.Get(), &count, sizeof(count));
+            std::lock_guard guard(mutex_);
+            return std::exchange(connections_, {});
+        }
+
+    private:
+        FileDescriptor fd_;
+        std::mutex mutex_;
+        std::vector<uint64_t> connections_;
+    };
+
+    class SocketServer {
+    public:
+        SocketServer(request_handler::RequestHandler& handler, const SocketSettings& settings)
+            : handler_(handler)
+            , settings_(settings)
+            , listener_(Listen(settings, socket_inode_))
+            , epoll_(epoll_create1(EPOLL_CLOEXEC))
+            , pool_(settings.workers > 0 ? settings.workers : std::max(1u, std::thread::hardware_concurrency())) {
+            if (epoll_.Get() < 0) {
+                throw MakeSystemError("Cannot create epoll");
+            }
+            ReserveDescriptor();
+            Watch(listener_.Get(), LISTENER, EPOLLIN);
+            Watch(notifier_.GetFd(), NOTIFIER, EPOLLIN);
+        }
+
+        // Removes the socket file, unless another one has replaced it
+        ~SocketServer() {
+            struct stat status{};
+            if (socket_inode_ != 0 && lstat(settings_.path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)
+                && status.st_ino == socket_inode_) {
+                unlink(settings_.path.c_str());
+            }
+        }
+
+        void Run() {
+            const StopSignals signals(notifier_.GetFd());
+            std::vector<epoll_event> events(256);
+            while (!stop_requested) {
+                const int count = epoll_wait(epoll_.Get(), events.data(), static_cast<int>(events.size()), -1);
+                if (count < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw MakeSystemError("epoll_wait failed");
+                }
+                for (int i = 0; i < count; ++i) {
+                    const uint64_t id = events[i].data.u64;
+                    if (id == LISTENER) {
+                        Accept();
+                    } else if (id == NOTIFIER) {
+                        for (const uint64_t connection : notifier_.Take()) {
+                            if (const auto it = connections_.find(connection); it != connections_.end()) {
+                                Update(connection, it->second);
+                            }
+                        }
+                    } else if (const auto it = connections_.find(id); it != connections_.end()) {
+                        OnEvents(id, it->second, events[i].events);
+                    }
+                }
+            }
+        }
+
+    private:
+        static const uint64_t LISTENER = 0;
+        static const uint64_t NOTIFIER = 1;
+
+        void Watch(int fd, uint64_t id, uint32_t events) {
+            epoll_event event{};
+            event.events = events;
+            event.data.u64 = id;
+            if (epoll_ctl(epoll_.Get(), EPOLL_CTL_ADD, fd, &event) != 0) {
+                throw MakeSystemError("epoll_ctl failed");
+            }
+        }
+
+        // A descriptor kept for accepting the clients which come when all
+        // the others are taken, only to tell them so and close
+        void ReserveDescriptor() {
+            reserve_ = FileDescriptor(open("/dev/null", O_RDONLY | O_CLOEXEC));
+        }
+
+        // The listener is level-triggered: a client left pending wakes the
+        // loop again at once, so it is either accepted or the listener is
+        // not watched until a connection is closed
+        void Accept() {
+            while (true) {
+                FileDescriptor fd(accept4(listener_.Get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+                if (fd.Get() < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED) {
+                        // A client gone already
+                        continue;
+                    }
+                    if ((errno == EMFILE || errno == ENFILE) && reserve_.Get() >= 0) {
+                        // The limit is checked before the queue, it may be empty
+                        reserve_ = FileDescriptor();
+                        const bool refused = RefuseClient();
+                        ReserveDescriptor();
+                        if (refused) {
+                            continue;
+                        }
+                        return;
+                    }
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        // Out of descriptors or memory, with no reserve left
+                        PauseListener(true);
+                    }
+                    return;
+                }
+                if (settings_.path.empty()) {
+                    const int on = 1;
+                    setsockopt(fd.Get(), IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                }
+                const uint64_t id = next_id_++;
+                Connection& connection = connections_[id];
+                connection.fd = std::move(fd);
+                connection.events = EPOLLIN;
+                Watch(connection.fd.Get(), id, connection.events);
+            }
+        }
+
+        bool RefuseClient() {
+            const FileDescriptor fd(accept4(listener_.Get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+            if (fd.Get() < 0) {
+                return false;
+            }
+            std::string answer;
+            WriteError("Too many connections"sv, answer);
+            [[maybe_unused]] const ssize_t sent = send(fd.Get(), answer.data(), answer.size(), MSG_NOSIGNAL);
+            return true;
+        }
+
+        void PauseListener(bool pause) {
+            if (listener_paused_ == pause) {
+                return;
+            }
+            listener_paused_ = pause;
+            epoll_event event{};
+            event.events = pause ? 0u : static_cast<uint32_t>(EPOLLIN);
+            event.data.u64 = LISTENER;
+            epoll_ctl(epoll_.Get(), EPOLL_CTL_MOD, listener_.Get(), &event);
+        }
+
+        void OnEvents(uint64_t id, Connection& connection, uint32_t events) {
+            if (events & EPOLLERR) {
+                Close(id);
+                return;
+            }
+            if (events & (EPOLLIN | EPOLLHUP)) {
+                Receive(id, connection);
+            }
+            // Hung up both ways, the answers cannot be sent
+            if ((events & EPOLLHUP) && connection.input_closed) {
+                Close(id);
+                return;
+            }
+            Update(id, connection);
+        }
+
+        void Receive(uint64_t id, Connection& connection) {
+            char buffer[1 << 16];
+            while (!connection.input_closed && CanTakeLines(connection)) {
+                const ssize_t received = recv(connection.fd.Get(), buffer, sizeof(buffer), 0);
+                if (received > 0) {
+                    connection.input.append(buffer, received);
+                    TakeLines(id, connection);
+                    CheckLineLength(id, connection);
+                } else if (received == 0 || (errno != EINTR && errno != EAGAIN)) {
+                    // The last line may have no line break
+                    connection.input_closed = true;
+                    if (!connection.input.empty() && connection.input.back() != '\n') {
+                        connection.input.push_back('\n');
+                    }
+                } else if (errno == EAGAIN) {
+                    return;
+                }
+            }
+        }
+
+        // The line not received in full yet is dropped if it is too long,
+        // nothing more is read from the client
+        void CheckLineLength(uint64_t id, Connection& connection) {
+            const size_t last_break = connection.input.rfind('\n');
+            const size_t line_start = last_break == std::string::npos ? 0 : last_break + 1;
+            if (connection.input.size() - line_start <= settings_.max_line_bytes) {
+                return;
+            }
+            connection.input.resize(line_start);
+            connection.input_closed = true;
+            connection.line_too_long = true;
+            TakeLines(id, connection);
+        }
+
+        bool CanTakeLines(const Connection& connection) const {
+            return !connection.exiting && connection.slots.size() < settings_.max_pipelined_lines
+                && connection.output.size() - connection.sent < settings_.max_unsent_bytes;
+        }
+
+        // Sends the complete lines to the workers while the client is within its limits
+        void TakeLines(uint64_t id, Connection& connection) {
+            size_t start = 0;
+            for (size_t end; CanTakeLines(connection) && (end = connection.input.find('\n', start)) != std::string::npos;
+                 start = end + 1) {
+                std::string line = connection.input.substr(start, end - start);
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if (line == "exit"sv) {
+                    connection.exiting = true;
+                } else if (!line.empty()) {
+                    auto slot = std::make_shared<Slot>();
+                    connection.slots.push_back(slot);
+                    pool_.Submit([this, id, slot, line = std::move(line)] {
+                        AnswerLine(handler_, line, slot->answer);
+                        slot->done.store(true, std::memory_order_release);
+                        notifier_.Notify(id);
+                    });
+                }
+            }
+            connection.input.erase(0, start);
+
+            // After the lines before it, so the answers stay in order
+            if (connection.line_too_long && connection.input.empty() && !connection.exiting) {
+                auto slot = std::make_shared<Slot>();
+                WriteError("The line is longer than "s + std::to_string(settings_.max_line_bytes) + " bytes"s, slot->answer);
+                slot->done = true;
+                connection.slots.push_back(std::move(slot));
+                connection.line_too_long = false;
+            }
+        }
+
+        // Moves the answers ready in order to the output, sends what the
+        // socket takes and takes more lines if the client is within its limits
+        void Update(uint64_t id, Connection& connection) {
+            while (!connection.slots.empty() && connection.slots.front()->done.load(std::memory_order_acquire)) {
+                connection.output += connection.slots.front()->answer;
+                connection.slots.pop_front();
+            }
+            if (!Send(connection)) {
+                Close(id);
+                return;
+            }
+            TakeLines(id, connection);
+
+            const bool finished = connection.slots.empty() && connection.sent == connection.output.size();
+            if (finished && (connection.input_closed || connection.exiting)) {
+                Close(id);
+                return;
+            }
+
+            uint32_t events = 0;
+            if (!connection.input_closed && CanTakeLines(connection)) {
+                events |= EPOLLIN;
+            }
+            if (connection.sent < connection.output.size()) {
+                events |= EPOLLOUT;
+            }
+            if (events != connection.events) {
+                connection.events = events;
+                epoll_event event{};
+                event.events = events;
+                event.data.u64 = id;
+                epoll_ctl(epoll_.Get(), EPOLL_CTL_MOD, connection.fd.Get(), &event);
+            }
+        }
+
+        // False if the client is gone
+        bool Send(Connection& connection) {
+            while (connection.sent < connection.output.size()) {
+                const ssize_t sent = send(connection.fd.Get(), connection.output.data() + connection.sent,
+                                          connection.output.size() - connection.sent, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return errno == EAGAIN;
+                }
+                connection.sent += sent;
+            }
+            connection.output.clear();
+            connection.sent = 0;
+            return true;
+        }
+
+        void Close(uint64_t id) {
+            // Workers may still answer its lines, the answers are dropped
+            const auto it = connections_.find(id);
+            epoll_ctl(epoll_.Get(), EPOLL_CTL_DEL, it->second.fd.Get(), nullptr);
+            connections_.erase(it);
+            // A descriptor is free again
+            if (reserve_.Get() < 0) {
+                ReserveDescriptor();
+            }
+            PauseListener(false);
+        }
+
+        request_handler::RequestHandler& handler_;
+        const SocketSettings& settings_;
+        // Set by Listen, so declared before the listener
+        ino_t socket_inode_ = 0;
+        FileDescriptor listener_;
+        bool listener_paused_ = false;
+        FileDescriptor reserve_;
+        FileDescriptor epoll_;
+        Notifier notifier_;
+        std::unordered_map<uint64_t, Connection> connections_;
+        uint64_t next_id_ = NOTIFIER + 1;
+        // Declared last, so the workers are stopped before the rest goes
+        thread_pool::ThreadPool pool_;
+    };
+#endif
+
+}  // namespace
+
+    void AnswerLine(request_handler::RequestHandler& handler, const std::string& line, std::string& output) {
+        const size_t size = output.size();
+        try {
+            const json::Document document = json_reader::LoadJSON(line);
+            const json::Node& root = document.GetRoot();
+            if (root.IsArray()) {
+                AnswerRequests(handler, root.AsArray(), output);
+            } else if (root.IsMap() && root.AsMap().count("stat_requests")) {
+                AnswerRequests(handler, root.AsMap().at("stat_requests").AsArray(), output);
+            } else {
+                json::StreamBuilder answer(output, json::StreamBuilder::Format::LINE);
+                if (!handler.Answer(root, answer)) {
+                    throw std::invalid_argument("Unknown request type");
+                }
+                answer.Build();
+                output.push_back('\n');
+            }
+        } catch (const std::exception& e) {
+            // Nothing of a line answered in part is kept
+            output.resize(size);
+            WriteError(e.what(), output);
+        }
+    }
+
+    void AnswerRequests(request_handler::RequestHandler& handler, const json::Array& requests, std::string& output) {
+        json::StreamBuilder answer(output, json::StreamBuilder::Format::LINE);
+        answer.StartArray();
+        handler.AnswerAll(requests, answer);
+        answer.EndArray().Build();
+        output.push_back('\n');
+    }
+
+    void ServeStream(request_handler::RequestHandler& handler, std::istream& input, std::ostream& output) {
+        std::string line;
+        std::string answer;
+        while (std::getline(input, line) && line != "exit"sv) {
+            if (line.empty()) {
+                continue;
+            }
+            answer.clear();
+            AnswerLine(handler, line, answer);
+            // Flushed at once, the client waits for the answer to send more
+            output << answer << std::flush;
+        }
+    }
+
+    void ServeSockets(request_handler::RequestHandler& handler, const SocketSettings& settings) {
+#ifdef SERVER_EPOLL
+        SocketServer server(handler, settings);
+        server.Run();
+#else
+        (void)handler;
+        (void)settings;
+        throw std::runtime_error("The socket server needs epoll");
+#endif
+    }
+
+}  // namespace server
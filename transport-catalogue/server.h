@@ -0,0 +1,49 @@
+#pragma once
+
+#include "json.h"
+#include "request_handler.h"
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace server {
+
+    // Requests come one line each: a request, an array of them or a dict with
+    // "stat_requests". The answer takes one line too: the answer to the
+    // request or an array of the answers. A line which cannot be answered
+    // gets a dict with the error message.
+    void AnswerLine(request_handler::RequestHandler& handler, const std::string& line, std::string& output);
+    // The answers to the requests as one line
+    void AnswerRequests(request_handler::RequestHandler& handler, const json::Array& requests, std::string& output);
+
+    // Answers the lines of the input until it ends or a line says "exit"
+    void ServeStream(request_handler::RequestHandler& handler, std::istream& input, std::ostream& output);
+
+    struct SocketSettings {
+        // A Unix domain socket, or a TCP port on the loopback interface if empty
+        std::string path;
+        int port = 0;
+        // Threads answering the requests, one per core if 0
+        size_t workers = 0;
+        // A client is not read from while it has this many lines being
+        // answered or this many bytes of answers it has not read
+        size_t max_pipelined_lines = 256;
+        size_t max_unsent_bytes = 16 << 20;
+        // A client sending a longer line gets an error for it, the lines
+        // before it are answered and then the connection is closed
+        size_t max_line_bytes = 16 << 20;
+    };
+
+    // Serves many clients at once, each like ServeStream. One thread waits
+    // on all the connections with epoll, reads the lines and sends the
+    // answers. The lines are answered on a pool of workers, so the handler
+    // is used from several threads at once. Clients may send lines without
+    // waiting for the answers, which come back in the order of the lines.
+    // A client saying "exit" gets the answers to its lines before it and is
+    // disconnected, the others are served on. Returns on SIGINT or SIGTERM,
+    // the answers not sent yet are dropped.
+    void ServeSockets(request_handler::RequestHandler& handler, const SocketSettings& settings);
+
+}  // namespace server
@@ -0,0 +1,215 @@
+#include "stats.h"
+#include "histogram.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std::literals;
+
+namespace stats {
+
+    namespace {
+        std::atomic<bool> enabled = false;
+        std::mutex mutex;
+        Snapshot registry;
+
+        using histogram::LogHistogram;
+
+        const std::array<std::string_view, 5> LATENCY_TYPES = {"Stop"sv, "Bus"sv, "Route"sv, "Map"sv, "RouteMap"sv};
+        using LatencyHistograms = std::array<LogHistogram, LATENCY_TYPES.size()>;
+
+        // Written by its thread only, read by any. Nanoseconds.
+        struct ThreadLatencies {
+            std::array<std::array<std::atomic<uint64_t>, LogHistogram::BUCKET_COUNT>, LATENCY_TYPES.size()> counts;
+            std::array<std::atomic<uint64_t>, LATENCY_TYPES.size()> max;
+        };
+
+
+        // Kept here, not by their threads, so the requests of the threads
+        // already finished are counted too
+        std::mutex latencies_mutex;
+        std::vector<std::unique_ptr<ThreadLatencies>> thread_latencies;
+        // The totals when the window was reset last
+        LatencyHistograms window_start;
+
+        // Registered once by each thread, only that takes the lock
+        ThreadLatencies& GetThreadLatencies() {
+            thread_local ThreadLatencies* latencies = nullptr;
+            if (!latencies) {
+                std::lock_guard guard(latencies_mutex);
+                thread_latencies.push_back(std::make_unique<ThreadLatencies>());
+                latencies = thread_latencies.back().get();
+            }
+            return *latencies;
+        }
+
+        // The latencies counted by all the threads, under latencies_mutex
+        LatencyHistograms MergeLatencies() {
+            LatencyHistograms result;
+            for (size_t type = 0; type < LATENCY_TYPES.size(); ++type) {
+                uint64_t max = 0;
+                for (const auto& latencies : thread_latencies) {
+                    for (size_t i = 0; i < LogHistogram::BUCKET_COUNT; ++i) {
+                        result[type].AddToBucket(i, latencies->counts[type][i].load(std::memory_order_relaxed));
+                    }
+                    max = std::max(max, latencies->max[type].load(std::memory_order_relaxed));
+                }
+                result[type].SetMax(max);
+            }
+            return result;
+        }
+
+        Latencies GetPercentiles(const LatencyHistograms& histograms) {
+            const auto ms = [](uint64_t ns) {
+                return ns / 1e6;
+            };
+            Latencies result;
+            for (size_t type = 0; type < LATENCY_TYPES.size(); ++type) {
+                const LogHistogram& histogram = histograms[type];
+                if (histogram.GetCount() == 0) {
+                    continue;
+                }
+                result.emplace(std::string(LATENCY_TYPES[type]),
+                               Latency{histogram.GetCount(), ms(histogram.GetPercentile(50.)),
+                                       ms(histogram.GetPercentile(90.)), ms(histogram.GetPercentile(99.)),
+                                       ms(histogram.GetPercentile(99.9)), ms(histogram.GetMax())});
+            }
+            return result;
+        }
+    }
+
+    void Enable() {
+        enabled.store(true, std::memory_order_relaxed);
+    }
+
+    bool IsEnabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void AddTime(std::string_view name, double ms) {
+        if (!IsEnabled()) {
+            return;
+        }
+        std::lock_guard guard(mutex);
+        auto it = registry.timers.find(name);
+        if (it == registry.timers.end()) {
+            it = registry.timers.emplace(std::string(name), Timer{}).first;
+        }
+        Timer& timer = it->second;
+        ++timer.count;
+        timer.total_ms += ms;
+        timer.max_ms = std::max(timer.max_ms, ms);
+    }
+
+    void AddCount(std::string_view name, int64_t value) {
+        if (!IsEnabled()) {
+            return;
+        }
+        std::lock_guard guard(mutex);
+        auto it = registry.counters.find(name);
+        if (it == registry.counters.end()) {
+            it = registry.counters.emplace(std::string(name), 0).first;
+        }
+        it->second += value;
+    }
+
+    void SetGauge(std::string_view name, int64_t value) {
+        std::lock_guard guard(mutex);
+        auto it = registry.counters.find(name);
+        if (it == registry.counters.end()) {
+            registry.counters.emplace(std::string(name), value);
+        } else {
+            it->second = value;
+        }
+    }
+
+    Snapshot GetSnapshot() {
+        Snapshot snapshot;
+        {
+            std::lock_guard guard(mutex);
+            snapshot = registry;
+        }
+        std::lock_guard guard(latencies_mutex);
+        snapshot.latencies = GetPercentiles(MergeLatencies());
+        return snapshot;
+    }
+
+    void AddLatency(std::string_view type, std::chrono::steady_clock::duration latency) {
+        const auto it = std::find(LATENCY_TYPES.begin(), LATENCY_TYPES.end(), type);
+        if (it == LATENCY_TYPES.end()) {
+            return;
+        }
+        const size_t index = it - LATENCY_TYPES.begin();
+        const auto ns = static_cast<uint64_t>(std::max<int64_t>(
+            0, std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()));
+        // Only this thread writes them, no read-modify-write is needed
+        ThreadLatencies& latencies = GetThreadLatencies();
+        auto& count = latencies.counts[index][LogHistogram::GetBucket(ns)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (ns > latencies.max[index].load(std::memory_order_relaxed)) {
+            latencies.max[index].store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    Latencies GetLatencyWindow(bool reset) {
+        std::lock_guard guard(latencies_mutex);
+        const LatencyHistograms totals = MergeLatencies();
+        LatencyHistograms window = totals;
+        for (size_t type = 0; type < LATENCY_TYPES.size(); ++type) {
+            window[type].Subtract(window_start[type]);
+        }
+        if (reset) {
+            window_start = totals;
+        }
+        return GetPercentiles(window);
+    }
+
+    void Print(const Snapshot& snapshot, std::ostream& output) {
+        const auto flags = output.flags();
+        const auto precision = output.precision();
+        output << std::fixed << std::setprecision(3);
+        for (const auto& [name, timer] : snapshot.timers) {
+            output << std::left << std::setw(24) << name << std::right << std::setw(12) << timer.total_ms << " ms"sv;
+            if (timer.count > 1) {
+                output << " in "sv << timer.count << ", max "sv << timer.max_ms << " ms"sv;
+            }
+            output << '\n';
+        }
+        for (const auto& [name, value] : snapshot.counters) {
+            output << std::left << std::setw(24) << name << std::right << std::setw(12) << value << '\n';
+        }
+        // Most requests take microseconds
+        for (const auto& [type, latency] : snapshot.latencies) {
+            output << std::left << std::setw(24) << "latency."s + type << std::right << std::setw(12) << latency.count
+                   << " requests, p50 "sv << latency.p50_ms * 1e3 << ", p90 "sv << latency.p90_ms * 1e3
+                   << ", p99 "sv << latency.p99_ms * 1e3 << ", p99.9 "sv << latency.p999_ms * 1e3
+                   << ", max "sv << latency.max_ms * 1e3 << " us\n"sv;
+        }
+        output.flags(flags);
+        output.precision(precision);
+    }
+
+    ScopedTimer::ScopedTimer(std::string_view name)
+        : name_(name)
+        , enabled_(IsEnabled() || trace::IsEnabled()) {
+        if (enabled_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ScopedTimer::~ScopedTimer() {
+        if (!enabled_) {
+            return;
+        }
+        const auto end = std::chrono::steady_clock::now();
+        AddTime(name_, std::chrono::duration<double, std::milli>(end - start_).count());
+        trace::AddSpan(name_, "phase"sv, start_, end);
+    }
+
+}  // namespace stats
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace stats {
+
+    // Phases of the program timed and the sizes of what they made. Names are
+    // like "router.precompute", the part before the dot is the module.
+    // Timers, counters and latencies are recorded only once Enable is
+    // called, by --stats or the first Stats request: a server times every
+    // line it answers, and each record takes a lock or reads the clock.
+    // Gauges are set a few times a run and are always kept.
+
+    struct Timer {
+        size_t count = 0;
+        double total_ms = 0.;
+        double max_ms = 0.;
+    };
+
+    // Percentiles of the latencies of requests of a type
+    struct Latency {
+        uint64_t count = 0;
+        double p50_ms = 0.;
+        double p90_ms = 0.;
+        double p99_ms = 0.;
+        double p999_ms = 0.;
+        double max_ms = 0.;
+    };
+    using Latencies = std::map<std::string, Latency, std::less<>>;
+
+    struct Snapshot {
+        std::map<std::string, Timer, std::less<>> timers;
+        // Counters are added to, gauges such as sizes in bytes are set
+        std::map<std::string, int64_t, std::less<>> counters;
+        // Since the start, by request type
+        Latencies latencies;
+    };
+
+    void Enable();
+    bool IsEnabled();
+
+    void AddTime(std::string_view name, double ms);
+    void AddCount(std::string_view name, int64_t value);
+    void SetGauge(std::string_view name, int64_t value);
+    Snapshot GetSnapshot();
+
+    // Latencies of Stop, Bus, Route, Map and RouteMap requests, the other
+    // types are not counted. Each thread counts into log-bucketed
+    // histograms of its own without locks, they are merged when read.
+    // Callers check IsEnabled before timing a request.
+    void AddLatency(std::string_view type, std::chrono::steady_clock::duration latency);
+    // Latencies since the last reset of the window, or since the start.
+    // With reset a new window starts, the threads go on counting meanwhile.
+    Latencies GetLatencyWindow(bool reset);
+
+    // One line for every timer, counter and request type
+    void Print(const Snapshot& snapshot, std::ostream& output);
+
+    // Adds the time from its creation to its end to the timer of the name,
+    // and a span to the trace if it is on. The name must be a literal. The
+    // clock is not read when neither is on.
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(std::string_view name);
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+        ~ScopedTimer();
+
+    private:
+        std::string_view name_;
+        bool enabled_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+}  // namespace stats
@@ -1,12 +1,11 @@
 #include "svg.h"
 
+#include <charconv>
 #include <iomanip>
 
 namespace svg {
     std::ostream& operator<<(std::ostream& out, Color output) {
-        std::ostringstream strm;
-        visit(OstreamPrinter{ strm }, output);
-        out << strm.str();
+        visit(OstreamPrinter{ out }, output);
         return out;
     }
 
@@ -52,7 +51,7 @@ namespace svg {
         // Делегируем вывод тега своим подклассам
         RenderObject(context);
 
-        context.out << std::endl;
+        context.out.put('\n');
     }
 
     // ---------- Circle ------------------
@@ -158,8 +157,8 @@ namespace svg {
       std::string font_weight_;*/
 
     void Document::Render(std::ostream& out) const {
-        out << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>"sv << std::endl;
-        out << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">"sv << std::endl;
+        out << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"sv;
+        out << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">\n"sv;
         RenderContext ctx(out, 2, 2);
         for (size_t i = 0; i < objects_.size(); i++) {
             objects_.at(i)->Render(ctx);
@@ -171,4 +170,158 @@ namespace svg {
         objects_.emplace_back(std::move(obj));
     }
 
+    // ---------- Writer ------------------
+
+    std::string Style::Render() const {
+        std::ostringstream out;
+        RenderAttrs(out);
+        return out.str();
+    }
+
+    std::string Writer::Escape(std::string_view markup) const {
+        std::string result;
+        Writer writer(result, escaping_);
+        writer.Put(markup);
+        return result;
+    }
+
+    void Writer::StartDocument() {
+        Put("<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"sv);
+        Put("<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">\n"sv);
+    }
+
+    void Writer::StartDocument(Point origin, Point size) {
+        Put("<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"sv);
+        Put("<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\" viewBox=\""sv);
+        WriteNumber(origin.x);
+        out_ += ' ';
+        WriteNumber(origin.y);
+        out_ += ' ';
+        WriteNumber(size.x);
+        out_ += ' ';
+        WriteNumber(size.y);
+        Put("\">\n"sv);
+    }
+
+    void Writer::EndDocument() {
+        Put("</svg>"sv);
+    }
+
+    void Writer::WriteCircle(Point center, double radius, std::string_view style) {
+        Put("  <circle cx=\""sv);
+        WriteNumber(center.x);
+        Put("\" cy=\""sv);
+        WriteNumber(center.y);
+        Put("\" r=\""sv);
+        WriteNumber(radius);
+        Put('"');
+        out_ += style;
+        Put("/>\n"sv);
+    }
+
+    void Writer::StartPolyline() {
+        Put("  <polyline points=\""sv);
+        first_point_ = true;
+    }
+
+    void Writer::AddPolylinePoint(Point point) {
+        if (!first_point_) {
+            out_ += ' ';
+        }
+        first_point_ = false;
+        WriteNumber(point.x);
+        out_ += ',';
+        WriteNumber(point.y);
+    }
+
+    void Writer::EndPolyline(std::string_view style) {
+        Put('"');
+        out_ += style;
+        Put("/>\n"sv);
+    }
+
+    void Writer::WriteText(Point position, std::string_view data, std::string_view style, std::string_view font) {
+        Put("  <text"sv);
+        out_ += style;
+        Put(" x=\""sv);
+        WriteNumber(position.x);
+        Put("\" y=\""sv);
+        WriteNumber(position.y);
+        Put("\" "sv);
+        out_ += font;
+        Put("\">"sv);
+        Put(data);
+        Put("</text>\n"sv);
+    }
+
+    std::string Writer::RenderTextFont(Point offset, uint32_t font_size, std::string_view font_family,
+                                       std::string_view font_weight) {
+        std::string result;
+        Writer writer(result);
+        result += "dx=\""sv;
+        writer.WriteNumber(offset.x);
+        result += "\" dy=\""sv;
+        writer.WriteNumber(offset.y);
+        result += "\" font-size=\""sv;
+        result += std::to_string(font_size);
+        if (!font_family.empty()) {
+            result += "\" font-family=\""sv;
+            result += font_family;
+        }
+        if (!font_weight.empty()) {
+            result += "\" font-weight=\""sv;
+            result += font_weight;
+        }
+        return result;
+    }
+
+    void Writer::Put(std::string_view markup) {
+        if (escaping_ == Escaping::NONE) {
+            out_ += markup;
+            return;
+        }
+        // The same escaping as json::Print and json::StreamBuilder use,
+        // runs of ordinary characters are copied at once
+        size_t begin = 0;
+        for (size_t i = 0; i < markup.size(); ++i) {
+            const char c = markup[i];
+            if (c == '\r' || c == '\n' || c == '"' || c == '\\') {
+                out_.append(markup.data() + begin, i - begin);
+                Put(c);
+                begin = i + 1;
+            }
+        }
+        out_.append(markup.data() + begin, markup.size() - begin);
+    }
+
+    void Writer::Put(char c) {
+        if (escaping_ == Escaping::NONE) {
+            out_ += c;
+            return;
+        }
+        switch (c) {
+            case '\r':
+                out_ += "\\r"sv;
+                break;
+            case '\n':
+                out_ += "\\n"sv;
+                break;
+            case '"':
+                [[fallthrough]];
+            case '\\':
+                out_ += '\\';
+                [[fallthrough]];
+            default:
+                out_ += c;
+                break;
+        }
+    }
+
+    // The same as std::ostream gives with precision 6
+    void Writer::WriteNumber(double value) {
+        char buffer[32];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::general, 6);
+        out_.append(buffer, result.ptr);
+    }
+
 }  // namespace svg
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cmath>
 #include <optional>
@@ -55,7 +56,7 @@ namespace svg {
         void operator()(std::monostate) const {
             out << "none";
         }
-        void operator()(std::string color) const {
+        void operator()(const std::string& color) const {
             out << color;
         }
         void operator()(Rgb rgb) const {
@@ -303,6 +304,62 @@ namespace svg {
         std::vector<std::unique_ptr<Object>> objects_;
     };
 
+    /*
+     * Атрибуты PathProps, общие для многих элементов. Выводятся в строку один раз,
+     * затем строка передаётся в Writer для каждого элемента.
+     */
+    class Style final : public PathProps<Style> {
+    public:
+        std::string Render() const;
+    };
+
+    /*
+     * Выводит элементы сразу в строку, без создания объектов в куче.
+     * Разметка совпадает с той, что выводит Document::Render.
+     * Разметку можно сразу экранировать как содержимое строки JSON.
+     */
+    class Writer {
+    public:
+        enum class Escaping {
+            NONE,
+            JSON,
+        };
+
+        explicit Writer(std::string& output, Escaping escaping = Escaping::NONE)
+            : out_(output)
+            , escaping_(escaping) {
+        }
+
+        // Строки style и font передаются в методы Write уже экранированными
+        std::string Escape(std::string_view markup) const;
+
+        void StartDocument();
+        // Документ с атрибутом viewBox, показывающий только часть картинки
+        void StartDocument(Point origin, Point size);
+        void EndDocument();
+
+        void WriteCircle(Point center, double radius, std::string_view style);
+
+        void StartPolyline();
+        void AddPolylinePoint(Point point);
+        void EndPolyline(std::string_view style);
+
+        // font - строка из RenderTextFont
+        void WriteText(Point position, std::string_view data, std::string_view style, std::string_view font);
+        // Атрибуты <text> от dx до font-weight, общие для надписей одного слоя
+        static std::string RenderTextFont(Point offset, uint32_t font_size, std::string_view font_family,
+                                          std::string_view font_weight);
+
+    private:
+        void Put(std::string_view markup);
+        void Put(char c);
+        void WriteNumber(double value);
+
+        std::string& out_;
+        Escaping escaping_;
+        bool first_point_ = true;
+    };
+
 }  // namespace svg
 
 namespace shapes {
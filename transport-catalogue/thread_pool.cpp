@@ -0,0 +1,129 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace thread_pool {
+
+    namespace {
+        // The pool and the queue of the worker running on this thread
+        thread_local const ThreadPool* current_pool = nullptr;
+        thread_local size_t current_queue = 0;
+    }
+
+    ThreadPool::ThreadPool(size_t threads) {
+        queues_.reserve(threads);
+        for (size_t i = 0; i < threads; ++i) {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+        workers_.reserve(threads);
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this, i] {
+                Work(i);
+            });
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard guard(mutex_);
+            stopping_ = true;
+        }
+        has_tasks_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    size_t ThreadPool::GetThreadCount() const {
+        return workers_.size();
+    }
+
+    size_t ThreadPool::GetOwnQueue() const {
+        return current_pool == this ? current_queue : queues_.size();
+    }
+
+    void ThreadPool::Push(std::function<void()> task) {
+        if (queues_.empty()) {
+            // Nobody would ever take it
+            task();
+            return;
+        }
+        size_t index = GetOwnQueue();
+        if (index == queues_.size()) {
+            index = next_queue_.fetch_add(1) % queues_.size();
+        }
+        {
+            // Counted along with the push, so the count never falls behind
+            // the tasks taken
+            std::lock_guard guard(queues_[index]->mutex);
+            queues_[index]->tasks.push_back(std::move(task));
+            ++queued_;
+        }
+        {
+            // A worker checking the count before it goes to sleep holds the
+            // lock, so it either sees the task or gets the notification
+            std::lock_guard guard(mutex_);
+        }
+        has_tasks_.notify_one();
+    }
+
+    bool ThreadPool::Take(size_t first, std::function<void()>& task) {
+        if (queued_ == 0) {
+            return false;
+        }
+        for (size_t i = 0; i < queues_.size(); ++i) {
+            const size_t index = (first + i) % queues_.size();
+            Queue& queue = *queues_[index];
+            std::lock_guard guard(queue.mutex);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            // The owner takes the oldest task, thieves the newest one
+            if (index == first && first == GetOwnQueue()) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            } else {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            --queued_;
+            return true;
+        }
+        return false;
+    }
+
+    bool ThreadPool::RunPendingTask() {
+        const size_t own = GetOwnQueue();
+        std::function<void()> task;
+        if (!Take(own == queues_.size() ? 0 : own, task)) {
+            return false;
+        }
+        task();
+        return true;
+    }
+
+    void ThreadPool::Work(size_t index) {
+        current_pool = this;
+        current_queue = index;
+        while (true) {
+            std::function<void()> task;
+            if (Take(index, task)) {
+                task();
+                continue;
+            }
+            std::unique_lock lock(mutex_);
+            has_tasks_.wait(lock, [this] {
+                return stopping_ || queued_ > 0;
+            });
+            if (stopping_ && queued_ == 0) {
+                return;
+            }
+        }
+    }
+
+    ThreadPool& GetDefaultPool() {
+        static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+}  // namespace thread_pool
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace thread_pool {
+
+    // Fixed set of worker threads, each with its own queue of tasks. A task
+    // submitted by a worker goes to its own queue, a task from another thread
+    // goes to the queues in turn. Workers take their own tasks oldest first,
+    // and when they run out they steal the newest tasks of the others, so a
+    // few slow tasks do not leave the other threads idle.
+    class ThreadPool {
+    public:
+        explicit ThreadPool(size_t threads);
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        // Waits for the queued tasks to finish
+        ~ThreadPool();
+
+        size_t GetThreadCount() const;
+
+        template <typename Func>
+        auto Submit(Func func) -> std::future<decltype(func())>;
+
+        // Runs one queued task on the calling thread, false if there are
+        // none. A thread waiting for a task may help the pool meanwhile.
+        bool RunPendingTask();
+
+        // Calls func(i) for every i in [0, count). The calling thread takes
+        // items too and waits only for the items other threads have taken,
+        // so it may be called from a task of the same pool.
+        // The first exception thrown by func is rethrown.
+        template <typename Func>
+        void ParallelFor(size_t count, Func func);
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        void Push(std::function<void()> task);
+        // A task of the queue given first or a task stolen from another one
+        bool Take(size_t first, std::function<void()>& task);
+        void Work(size_t index);
+        // Index of the queue of the calling thread, if it is a worker
+        size_t GetOwnQueue() const;
+
+        std::vector<std::unique_ptr<Queue>> queues_;
+        std::vector<std::thread> workers_;
+        // Tasks in all the queues, changed under the lock of the queue.
+        // Workers sleep while there are none.
+        std::atomic<size_t> queued_ = 0;
+        std::atomic<size_t> next_queue_ = 0;
+        std::mutex mutex_;
+        std::condition_variable has_tasks_;
+        bool stopping_ = false;
+    };
+
+    // The pool shared by the whole program, one thread per core
+    ThreadPool& GetDefaultPool();
+
+    template <typename Func>
+    auto ThreadPool::Submit(Func func) -> std::future<decltype(func())> {
+        using Result = decltype(func());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(func));
+        std::future<Result> result = task->get_future();
+        Push([task] {
+            (*task)();
+        });
+        return result;
+    }
+
+    template <typename Func>
+    void ThreadPool::ParallelFor(size_t count, Func func) {
+        if (count == 0) {
+            return;
+        }
+
+        // Helpers may start after the loop is over, so the state is shared with them
+        struct State {
+            explicit State(size_t count, Func func)
+                : count(count)
+                , func(std::move(func)) {
+            }
+
+            // Runs items until none are left
+            void Run() {
+                for (size_t i; (i = next.fetch_add(1)) < count;) {
+                    try {
+                        func(i);
+                    } catch (...) {
+                        std::lock_guard guard(mutex);
+                        if (!error) {
+                            error = std::current_exception();
+                        }
+                    }
+                    if (done.fetch_add(1) + 1 == count) {
+                        std::lock_guard guard(mutex);
+                        all_done.notify_all();
+                    }
+                }
+            }
+
+            const size_t count;
+            Func func;
+            std::atomic<size_t> next = 0;
+            std::atomic<size_t> done = 0;
+            std::mutex mutex;
+            std::condition_variable all_done;
+            std::exception_ptr error;
+        };
+
+        auto state = std::make_shared<State>(count, std::move(func));
+        const size_t helpers = std::min(count, workers_.size() + 1) - 1;
+        for (size_t i = 0; i < helpers; ++i) {
+            Push([state] {
+                state->Run();
+            });
+        }
+        state->Run();
+
+        std::unique_lock lock(state->mutex);
+        state->all_done.wait(lock, [&state] {
+            return state->done == state->count;
+        });
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+    }
+
+}  // namespace thread_pool
@@ -0,0 +1,153 @@
+#include "trace.h"
+#include "json_builder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+namespace trace {
+
+    namespace {
+
+        struct Event {
+            std::string_view name;
+            std::string_view category;
+            int64_t start_ns;
+            int64_t duration_ns;
+            int64_t id;
+        };
+
+        // Spans kept by a thread, 3.5 MiB once it records any
+        const size_t BUFFER_SIZE = 1 << 16;
+
+        // Written by its thread only. The count is published after the
+        // event, so the events before it may be read by another thread.
+        struct Buffer {
+            std::unique_ptr<Event[]> events = std::make_unique<Event[]>(BUFFER_SIZE);
+            std::atomic<uint64_t> count = 0;
+            int thread_id = 0;
+        };
+
+        std::atomic<bool> enabled = false;
+        Clock::time_point epoch;
+
+        // Buffers are kept here, not by their threads, so the spans of
+        // the threads already finished are written too
+        std::mutex buffers_mutex;
+        std::vector<std::unique_ptr<Buffer>> buffers;
+
+        // The buffers are registered once by each thread, only that takes the lock
+        Buffer& GetThreadBuffer() {
+            thread_local Buffer* buffer = nullptr;
+            if (!buffer) {
+                std::lock_guard guard(buffers_mutex);
+                buffers.push_back(std::make_unique<Buffer>());
+                buffer = buffers.back().get();
+                buffer->thread_id = static_cast<int>(buffers.size());
+            }
+            return *buffer;
+        }
+
+        void WriteInteger(json::StreamBuilder& output, int64_t value) {
+            char text[24];
+            const auto end = std::to_chars(text, text + sizeof(text), value).ptr;
+            output.RawValue(std::string_view(text, end - text));
+        }
+
+        // Microseconds with three decimals, as the format expects. A span
+        // begun before Start has a negative time.
+        void WriteMicroseconds(json::StreamBuilder& output, int64_t ns) {
+            char text[32];
+            char* end = text;
+            uint64_t magnitude = static_cast<uint64_t>(ns);
+            if (ns < 0) {
+                *end++ = '-';
+                magnitude = 0 - magnitude;
+            }
+            end = std::to_chars(end, text + sizeof(text), magnitude / 1000).ptr;
+            const uint64_t fraction = magnitude % 1000;
+            *end++ = '.';
+            *end++ = static_cast<char>('0' + fraction / 100);
+            *end++ = static_cast<char>('0' + fraction / 10 % 10);
+            *end++ = static_cast<char>('0' + fraction % 10);
+            output.RawValue(std::string_view(text, end - text));
+        }
+
+    }  // namespace
+
+    void Start() {
+        epoch = Clock::now();
+        enabled.store(true, std::memory_order_release);
+    }
+
+    bool IsEnabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void AddSpan(std::string_view name, std::string_view category, Clock::time_point start, Clock::time_point end,
+                 int64_t id) {
+        if (!enabled.load(std::memory_order_acquire)) {
+            return;
+        }
+        Buffer& buffer = GetThreadBuffer();
+        const uint64_t count = buffer.count.load(std::memory_order_relaxed);
+        buffer.events[count % BUFFER_SIZE] = Event{
+            name, category, std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch).count(),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), id};
+        buffer.count.store(count + 1, std::memory_order_release);
+    }
+
+    void Write(std::ostream& output) {
+        std::string text;
+        json::StreamBuilder builder(text, json::StreamBuilder::Format::LINE);
+        builder.StartDict().Key("displayTimeUnit"sv).Value("ms"sv).Key("traceEvents"sv).StartArray();
+        builder.StartDict().Key("args"sv).StartDict().Key("name"sv).Value("transport_catalogue"sv).EndDict()
+            .Key("name"sv).Value("process_name"sv).Key("ph"sv).Value("M"sv).Key("pid"sv).Value(1).EndDict();
+
+        std::lock_guard guard(buffers_mutex);
+        for (const auto& buffer : buffers) {
+            const uint64_t count = buffer->count.load(std::memory_order_acquire);
+            for (uint64_t i = count - std::min<uint64_t>(count, BUFFER_SIZE); i < count; ++i) {
+                const Event& event = buffer->events[i % BUFFER_SIZE];
+                builder.StartDict();
+                if (event.id != NO_ID) {
+                    builder.Key("args"sv).StartDict().Key("id"sv);
+                    WriteInteger(builder, event.id);
+                    builder.EndDict();
+                }
+                // A span ending before its start is written as an instant
+                builder.Key("cat"sv).Value(event.category).Key("dur"sv);
+                WriteMicroseconds(builder, std::max<int64_t>(event.duration_ns, 0));
+                builder.Key("name"sv).Value(event.name).Key("ph"sv).Value("X"sv).Key("pid"sv).Value(1)
+                    .Key("tid"sv).Value(buffer->thread_id).Key("ts"sv);
+                WriteMicroseconds(builder, event.start_ns);
+                builder.EndDict();
+            }
+        }
+        builder.EndArray().EndDict().Build();
+        output << text;
+    }
+
+    Span::Span(std::string_view name, std::string_view category, int64_t id)
+        : name_(name)
+        , category_(category)
+        , id_(id)
+        , enabled_(IsEnabled()) {
+        if (enabled_) {
+            start_ = Clock::now();
+        }
+    }
+
+    Span::~Span() {
+        if (enabled_) {
+            AddSpan(name_, category_, start_, Clock::now(), id_);
+        }
+    }
+
+}  // namespace trace
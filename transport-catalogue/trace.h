@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <string_view>
+
+namespace trace {
+
+    // Timelines of the phases and of the requests in the Trace Event format
+    // of Chrome, opened by chrome://tracing and ui.perfetto.dev. Nothing is
+    // recorded until Start, then every thread writes its spans into its own
+    // ring buffer without locks. A thread keeps its newest spans only.
+
+    using Clock = std::chrono::steady_clock;
+
+    // Spans of no request have no id. Ids of requests are int, so any of
+    // them, -1 too, is kept.
+    const int64_t NO_ID = std::numeric_limits<int64_t>::min();
+
+    void Start();
+    bool IsEnabled();
+
+    // Names and categories are kept as views, they must be literals.
+    // A request span gets its id as an argument.
+    void AddSpan(std::string_view name, std::string_view category, Clock::time_point start, Clock::time_point end,
+                 int64_t id = NO_ID);
+
+    // Writes the spans of all the threads. The threads must not record
+    // meanwhile, it is done at the exit.
+    void Write(std::ostream& output);
+
+    // Records the time from its creation to its end, if tracing is on
+    class Span {
+    public:
+        explicit Span(std::string_view name, std::string_view category = "phase", int64_t id = NO_ID);
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+        ~Span();
+
+    private:
+        std::string_view name_;
+        std::string_view category_;
+        int64_t id_;
+        bool enabled_;
+        Clock::time_point start_;
+    };
+
+}  // namespace trace
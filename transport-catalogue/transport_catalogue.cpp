@@ -32,11 +32,15 @@ namespace catalogue {
 		auto bus = buses_index_.at(name);
 		bus->is_roundtrip = is_roundtrip;
 
+		set<Stop*> unique_stops;
 		for (const string& stop : stops) {
-			bus->stops.push_back(stops_index_.at(stop));
-			buses_for_stops_[stop].push_back(bus);
-			coord_for_buses_.push_back(stops_index_.at(stop)->coord);
+			Stop* current = stops_index_.at(stop);
+			bus->stops.push_back(current);
+			unique_stops.insert(current);
+			buses_for_stops_[current->name].insert(bus->name);
+			coord_for_buses_.push_back(current->coord);
 		}
+		bus->unique_stops = unique_stops.size();
 
 		size_t length = bus->stops.size();
 		if (!is_roundtrip) {
@@ -46,48 +50,52 @@ namespace catalogue {
 		}
 	}
     
-	vector<string> TransportCatalogue::FindBus(const string_view& stop) {
+	vector<string> TransportCatalogue::FindBus(const string_view& stop) const {
 
 		vector<string> result;
 
-		if (buses_for_stops_.count(stop) == 0) {
+		const auto buses = GetBusesForStop(stop);
+		if (buses == nullptr) {
 			result.push_back("not found"s);
 			return result;
 		}
-		if (buses_for_stops_.at(stop).empty()) {
+		if (buses->empty()) {
 			result.push_back("no buses"s);
 			return result;
 		}
 
 		// Buses for stop
-		set<string> tmp_data;
-		for (const auto bus : buses_for_stops_.at(stop)) {
-			if (tmp_data.count(bus->name) == 0) {
-				tmp_data.insert(bus->name);
-				result.push_back(bus->name);
-			}
+		for (const auto bus : *buses) {
+			result.push_back(string(bus));
 		}
-		sort(result.begin(), result.end());
 
 		return result;
 	}
 
-	TransportCatalogue::BusInfo TransportCatalogue::GetBusInfo(const string_view& bus) {
+	const set<string_view>* TransportCatalogue::GetBusesForStop(string_view stop) const {
+		const auto it = buses_for_stops_.find(stop);
+		if (it == buses_for_stops_.end()) {
+			return nullptr;
+		}
+		return &it->second;
+	}
+
+	TransportCatalogue::BusInfo TransportCatalogue::GetBusInfo(const string_view& bus) const {
 		BusInfo result;
 
-		if (buses_index_.count(bus) == 0 || buses_index_.at(bus)->stops.empty()) {
+		const auto it = buses_index_.find(bus);
+		if (it == buses_index_.end() || it->second->stops.empty()) {
 			result.existence = false;
 			return result;
 		}
+		const Bus* current_bus = it->second;
 
 		// Calculate distances and curvature
 		double distance = 0.;
 		double real_distance = 0.;
-		Stop* current = buses_index_.at(bus)->stops.at(0);
-		set<string> unique_s;
+		Stop* current = current_bus->stops.at(0);
 		int first_num = 0;
-		for (const auto& stop : buses_index_.at(bus)->stops) {
-			unique_s.insert(stop->name);
+		for (const auto& stop : current_bus->stops) {
 			if (first_num == 0) {
 				first_num++;
 				continue;
@@ -107,10 +115,10 @@ namespace catalogue {
 			current = stop;
 		}
 
-		result.unique_stops = unique_s.size();
+		result.unique_stops = current_bus->unique_stops;
 		result.length = real_distance;
 		result.curvature = real_distance / distance;
-		result.stops_on_route = buses_index_.at(bus)->stops.size();
+		result.stops_on_route = current_bus->stops.size();
 
 		return result;
 	}
@@ -25,6 +25,7 @@ namespace catalogue {
             std::string name;
             std::vector<Stop*> stops;
             bool is_roundtrip;
+            int unique_stops = 0;
         };
 
         struct BusInfo {
@@ -40,14 +41,11 @@ namespace catalogue {
         void AddBus(const std::string& name);
         void AddBusRoute(const std::string& name, const std::vector<std::string>& stops, bool is_roundtrip);
         void AddBusCharacteristics(int bus_velocity, double bus_wait_time);
-        void MakeVertexesForGraph();
-        void MakeNewRoutes(Bus* bus, size_t begin, size_t end);
-        void MakeNewGraph();
-        
-        const graph::DirectedWeightedGraph<double>& GetGraph() const;
-        json::Dict GetGraphData(std::string_view from, std::string_view to, int id, graph::Router<double>& new_router);
-        std::vector<std::string> FindBus(const std::string_view& stop);
-        BusInfo GetBusInfo(const std::string_view& bus);
+
+        std::vector<std::string> FindBus(const std::string_view& stop) const;
+        // Sorted names of buses for the stop, nullptr if the stop is unknown
+        const std::set<std::string_view>* GetBusesForStop(std::string_view stop) const;
+        BusInfo GetBusInfo(const std::string_view& bus) const;
         std::vector<geo::Coordinates> GetCoordinates() const;
         std::vector<Stop*> GetBusStops(const std::string_view& bus) const;
         bool BusWithRoundtrip(const std::string_view& bus) const;
@@ -61,7 +59,7 @@ namespace catalogue {
         std::unordered_map<std::string_view, Stop*> stops_index_;
         std::deque<Bus> buses_;
         std::unordered_map<std::string_view, Bus*> buses_index_;
-        std::unordered_map<std::string_view, std::vector<Bus*>> buses_for_stops_;
+        std::unordered_map<std::string_view, std::set<std::string_view>> buses_for_stops_;
         std::unordered_map<std::string_view, std::unordered_map<std::string, double>> real_distances_;
         std::vector<geo::Coordinates> coord_for_buses_;
     };
@@ -1,4 +1,6 @@
 #include "transport_router.h"
+#include "stats.h"
+#include "trace.h"
 
 using namespace std;
 
@@ -14,6 +16,7 @@ void TransportRouter::SetSettings(int bus_velocity, double bus_wait_time) {
     }
     
     void TransportRouter::MakeStops() {
+        trace::Span span("router.make_stops"sv);
         size_t id = 0;
         for(const auto& [name, stop] : catalogue_->GetStopsIndex()) {
             stops_ids_[stop->name] = id;
@@ -61,6 +64,7 @@ void TransportRouter::SetSettings(int bus_velocity, double bus_wait_time) {
     }
     
     void TransportRouter::MakeRoutes() {
+        trace::Span span("router.make_routes"sv);
         for (auto [name, bus] : catalogue_->GetBusesIndex()) {
             if(!bus->is_roundtrip) {
                 MakeLocalRoutes(bus, 0, bus->stops.size()/2);
@@ -72,17 +76,20 @@ void TransportRouter::SetSettings(int bus_velocity, double bus_wait_time) {
     }
 
     void TransportRouter::MakeGraph() {
+        stats::ScopedTimer timer("router.graph"sv);
         graph::DirectedWeightedGraph<double> new_graph(catalogue_->GetStopsIndex().size() * 2);
         graph_ = std::move(new_graph);
         MakeStops();
         MakeRoutes();
+        stats::SetGauge("router.vertexes"sv, graph_.GetVertexCount());
+        stats::SetGauge("router.edges"sv, graph_.GetEdgeCount());
     }
 
     const graph::DirectedWeightedGraph<double>& TransportRouter::GetGraph() const {
         return graph_;
     }
 
-    json::Dict TransportRouter::GetGraphData(std::string_view from, std::string_view to, int id, graph::Router<double>& new_router) {
+    json::Dict TransportRouter::GetGraphData(std::string_view from, std::string_view to, int id, const graph::Router<double>& new_router) const {
         json::Dict result;
         result["request_id"] = id;
         std::vector<std::optional<graph::Router<double>::RouteInfo>> info;
@@ -92,7 +99,17 @@ void TransportRouter::SetSettings(int bus_velocity, double bus_wait_time) {
             result["items"] = route_info;
             return result;
         }
-        std::optional<graph::Router<double>::RouteInfo> best = new_router.BuildRoute(stops_ids_.at(from)+1, stops_ids_.at(to)+1);
+        const graph::VertexId from_id = stops_ids_.at(from) + 1;
+        const graph::VertexId to_id = stops_ids_.at(to) + 1;
+        // Without the cache the route is kept here, with no allocation for it
+        std::shared_ptr<const Route> cached;
+        Route found;
+        if (route_cache_) {
+            cached = FindCachedRoute(from_id, to_id, new_router);
+        } else {
+            found = new_router.BuildRoute(from_id, to_id);
+        }
+        const Route& best = cached ? *cached : found;
 
         if(!best) {
             result["error_message"] = nullptr;  
@@ -104,7 +121,7 @@ void TransportRouter::SetSettings(int bus_velocity, double bus_wait_time) {
         json::Array route_info = {};
         double total_time = 0.;
 
-        for(auto edge: best.value().edges) {
+        for(auto edge: best->edges) {
             if(graph_.GetEdge(edge).from % 2 == 1) {
                 stops_info["stop_name"] = graph_.GetEdge(edge).bus;
                 stops_info["time"] = graph_.GetEdge(edge).weight;
@@ -127,4 +144,23 @@ void TransportRouter::SetSettings(int bus_velocity, double bus_wait_time) {
         result["total_time"] = total_time;
         return result;
     }
+    void TransportRouter::EnableRouteCache(size_t budget_bytes) {
+        route_cache_ = std::make_unique<RouteCache>(budget_bytes);
+    }
+
+    lru_cache::CacheStats TransportRouter::GetRouteCacheStats() const {
+        return route_cache_ ? route_cache_->GetStats() : lru_cache::CacheStats{};
+    }
+
+    std::shared_ptr<const TransportRouter::Route> TransportRouter::FindCachedRoute(graph::VertexId from, graph::VertexId to,
+                                                                                   const graph::Router<double>& new_router) const {
+        const uint64_t key = static_cast<uint64_t>(from) << 32 | to;
+        if (auto route = route_cache_->Find(key)) {
+            return route;
+        }
+        auto route = std::make_shared<const Route>(new_router.BuildRoute(from, to));
+        const size_t bytes = sizeof(Route) + (*route ? (*route)->edges.size() * sizeof(graph::EdgeId) : 0);
+        route_cache_->Insert(key, route, bytes);
+        return route;
+    }
 }  // namespace router
\ No newline at end of file
@@ -1,7 +1,14 @@
+#pragma once
+
 #include "transport_catalogue.h"
 #include "graph.h"
+#include "lru_cache.h"
 #include "router.h"
 
+#include <cstdint>
+#include <memory>
+#include <optional>
+
 
 namespace router {
 class TransportRouter {
@@ -15,18 +22,32 @@ public:
     void SetSettings(int bus_velocity, double bus_wait_time);
     void MakeGraph();
     const graph::DirectedWeightedGraph<double>& GetGraph() const;
-    json::Dict GetGraphData(std::string_view from, std::string_view to, int id, graph::Router<double>& new_router);
+    // Answer to a Route request, the router must be built on GetGraph().
+    // It may be called from many threads at once.
+    json::Dict GetGraphData(std::string_view from, std::string_view to, int id, const graph::Router<double>& new_router) const;
+    // Keeps the routes found for the pairs of stops asked most recently,
+    // within the budget, so the router is not asked for them again
+    void EnableRouteCache(size_t budget_bytes);
+    lru_cache::CacheStats GetRouteCacheStats() const;
     
 private:
+    // Nothing if there is no route
+    using Route = std::optional<graph::Router<double>::RouteInfo>;
+    // By the ids of the vertexes from and to, each below 2^32
+    using RouteCache = lru_cache::LruCache<uint64_t, Route>;
+
     const catalogue::TransportCatalogue* catalogue_;
     graph::DirectedWeightedGraph<double> graph_;
     std::unordered_map<size_t, std::string> ids_stops_;
     std::unordered_map<std::string_view, size_t> stops_ids_;
     BusSettings bus_settings_;
+    std::unique_ptr<RouteCache> route_cache_;
     
     void MakeStops();
     void MakeLocalRoutes(catalogue::TransportCatalogue::Bus* bus, size_t begin, size_t end);
     void MakeRoutes();
+    // The cache must be enabled
+    std::shared_ptr<const Route> FindCachedRoute(graph::VertexId from, graph::VertexId to, const graph::Router<double>& new_router) const;
     
 };
 }  // namespace router
\ No newline at end of file